@@ -0,0 +1,76 @@
+package ldapcpp
+
+// Future is the pending result of a non-blocking operation
+type Future struct {
+	done chan struct{}
+	err  error
+}
+
+func newFuture() *Future {
+	return &Future{done: make(chan struct{})}
+}
+
+// Done returns a channel, that is closed when the operation is complete
+func (f *Future) Done() <-chan struct{} {
+	return f.done
+}
+
+// Wait blocks until the operation is complete and returns its error
+func (f *Future) Wait() error {
+	<-f.done
+	return f.err
+}
+
+// SearchFuture is the pending result of a non-blocking search
+type SearchFuture struct {
+	Future
+	res *SearchResult
+}
+
+// Wait blocks until the search is complete and returns its result
+func (f *SearchFuture) Wait() (*SearchResult, error) {
+	<-f.done
+	return f.res, f.err
+}
+
+// submit sends an async request with a client leased from the pool. The client
+// goes back to the pool right away, but it is kept open until wait is called.
+func (conn *Conn) submit(send func(client Client) int) (pc *pooledClient, msgid int, err error) {
+	pc, err = conn.pool.get()
+	if err != nil {
+		return nil, 0, err
+	}
+	defer func() { conn.pool.put(pc, err) }()
+	defer Recover(&err)
+
+	msgid = send(pc.client)
+	conn.pool.track(pc)
+
+	return pc, msgid, nil
+}
+
+// wait collects the result of the async request with the given msgid, it blocks
+// only the calling goroutine and does not hold the client. Remaining ranges of
+// ranged attributes are fetched afterwards, with a client leased from the pool.
+func (conn *Conn) wait(pc *pooledClient, msgid int) (result AsyncResult, err error) {
+	result, err = conn.collect(pc, msgid)
+	if err != nil || !result.GetEntries().Ranged() {
+		return result, err
+	}
+
+	err = conn.lease(func(client Client) {
+		client.AsyncResolve(result)
+	})
+	if err != nil {
+		DeleteAsyncResult(result)
+		return nil, err
+	}
+	return result, nil
+}
+
+func (conn *Conn) collect(pc *pooledClient, msgid int) (result AsyncResult, err error) {
+	defer conn.pool.done(pc)
+	defer Recover(&err)
+
+	return pc.client.AsyncWait(msgid), nil
+}
@@ -6,7 +6,6 @@ import (
 	"crypto/tls"
 	"net"
 	"net/url"
-	"sync"
 	"time"
 )
 
@@ -21,22 +20,204 @@ type DialOpt func(*DialContext)
 type DialContext struct {
 	dialer    *net.Dialer
 	tlsConfig *tls.Config
+
+	pageSize         int
+	maxPageSize      int
+	pageMemoryBudget int64
+
+	fallbackAddrs  []string
+	connectStagger time.Duration
+	probeTimeout   time.Duration
+
+	readRetries int
+	keepAlive   time.Duration
+
+	entryCacheBytes int64
+	entryCacheTTL   time.Duration
+
+	negativeCacheSize int
+	negativeCacheTTL  time.Duration
+
+	maxRangeValues int
+	lookupWindow   int
+
+	poolMinSize             int
+	poolMaxSize             int
+	poolIdleTimeout         time.Duration
+	poolHealthCheckInterval time.Duration
+}
+
+// DialWithPageSize sets the default page size of paged searches on the connection.
+// Use PageSizeAdaptive to let the page size follow the observed entry sizes.
+func DialWithPageSize(size int) DialOpt {
+	return func(dc *DialContext) {
+		dc.pageSize = size
+	}
+}
+
+// DialWithAdaptivePageSize enables the adaptive page size on the connection.
+// The page size grows up to maxPageSize (server's MaxPageSize) while the estimated
+// size of a single page stays within memoryBudget bytes.
+func DialWithAdaptivePageSize(maxPageSize int, memoryBudget int64) DialOpt {
+	return func(dc *DialContext) {
+		dc.pageSize = PageSizeAdaptive
+		dc.maxPageSize = maxPageSize
+		dc.pageMemoryBudget = memoryBudget
+	}
+}
+
+// DialWithFallbacks adds servers, that are tried when the server of the dialed URL
+// is not available. Servers are given as host[:port] or as URLs.
+func DialWithFallbacks(addrs ...string) DialOpt {
+	return func(dc *DialContext) {
+		dc.fallbackAddrs = append(dc.fallbackAddrs, addrs...)
+	}
+}
+
+// DialWithParallelConnect connects to the dialed server and its fallbacks in parallel,
+// starting each attempt stagger after the previous one (or right away when an attempt
+// fails), and keeps the first bound connection. Without it servers are tried one by one.
+func DialWithParallelConnect(stagger time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.connectStagger = stagger
+	}
+}
+
+// DialWithServerProbe reads rootDSE of the dialed server and its fallbacks (concurrently,
+// within timeout) before each bind. Servers are tried fastest first, by the probes and
+// by latency and errors of earlier operations. Use a cldap:// URL to probe over UDP.
+func DialWithServerProbe(timeout time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.probeTimeout = timeout
+	}
 }
 
-// Conn represents an LDAP Connection
+// DialWithReadRetries sets how many times a search is sent again, after the session
+// has been lost and the client has bound again (to another server, if there is one).
+// Searches are retried once by default, zero disables retries.
+func DialWithReadRetries(retries int) DialOpt {
+	return func(dc *DialContext) {
+		dc.readRetries = retries
+	}
+}
+
+// DialWithKeepAlive enables TCP keepalive probes after idle time of inactivity, and
+// health checks of idle pooled clients at the same interval (unless they are checked
+// more often). Clients, that have lost their session, bind again.
+func DialWithKeepAlive(idle time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.keepAlive = idle
+		if idle > 0 && (dc.poolHealthCheckInterval <= 0 || idle < dc.poolHealthCheckInterval) {
+			dc.poolHealthCheckInterval = idle
+		}
+	}
+}
+
+// DialWithEntryCache caches results of GetObjectAttributes and DNExists for ttl,
+// in up to maxBytes of memory shared by all pooled clients. Changes made through
+// the connection invalidate cached lookups of changed objects.
+func DialWithEntryCache(maxBytes int64, ttl time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.entryCacheBytes = maxBytes
+		dc.entryCacheTTL = ttl
+	}
+}
+
+// DialWithNegativeCache remembers up to maxEntries lookups of GetObjectAttributes and
+// DNExists, that have failed because the object or attribute is missing, for ttl.
+// Repeated lookups fail from the cache. Keep ttl short, as objects created by other
+// connections are not seen until it expires.
+func DialWithNegativeCache(maxEntries int, ttl time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.negativeCacheSize = maxEntries
+		dc.negativeCacheTTL = ttl
+	}
+}
+
+// DialWithRangeLimit caps the values of an attribute, that the server returns in ranges
+// (Active Directory returns MaxValRange values, 1500 by default, e.g. as "member;range=0-1499").
+// Remaining ranges are fetched and merged into the attribute up to maxValues in total,
+// all of them if maxValues is 0. A capped attribute keeps the name of the kept range,
+// e.g. "member;range=0-4999". Use AttributeStream to read all values range by range.
+func DialWithRangeLimit(maxValues int) DialOpt {
+	return func(dc *DialContext) {
+		dc.maxRangeValues = maxValues
+	}
+}
+
+// DialWithLookupWindow sets how many base searches of bulk lookups (ResolveAttribute)
+// a client keeps in flight at once.
+func DialWithLookupWindow(window int) DialOpt {
+	return func(dc *DialContext) {
+		dc.lookupWindow = window
+	}
+}
+
+// Conn represents an LDAP Connection.
+// Operations lease bound clients from a pool, so they run concurrently up to the pool size.
 type Conn struct {
-	sync.Mutex
+	pool *pool
+	addr string
+	// fallback servers, after addr
+	fallbackAddrs []string
+	// delay between parallel connection attempts, 0 to connect sequentially
+	connectStagger time.Duration
+	// rootDSE probe timeout of servers before bind, 0 to bind without probing
+	probeTimeout time.Duration
+	// times a search is retried after reconnect
+	readRetries int
+	// TCP keepalive idle time, 0 to keep system defaults
+	keepAlive time.Duration
 
-	client Client
-	addr   string
+	// attribute names of returned entries
+	names *attributeNames
+	// cache of base lookups, shared by pooled clients, nil if disabled
+	entryCache EntryCache
+	// cache of failed base lookups, shared by pooled clients, nil if disabled
+	negativeCache NegativeCache
 
 	netTimeout int
 	timeLimit  int
+
+	pageSize         int
+	maxPageSize      int
+	pageMemoryBudget int64
+
+	// values kept of ranged attributes, 0 for all
+	maxRangeValues int
+	// base searches in flight of bulk lookups, 0 for the default
+	lookupWindow int
+}
+
+func (conn *Conn) setPaging(params ClientConnParams) {
+	if conn.pageSize != PageSizeDefault {
+		params.SetPagesize(conn.pageSize)
+	}
+	if conn.maxPageSize > 0 {
+		params.SetMax_pagesize(conn.maxPageSize)
+	}
+	if conn.pageMemoryBudget > 0 {
+		params.SetPage_memory_budget(conn.pageMemoryBudget)
+	}
 }
 
 // Close closes the connection.
 func (conn *Conn) Close() {
-	DeleteClient(conn.client)
+	conn.pool.close()
+
+	// clients bound meanwhile take the caches under the pool lock, they see the pool closed from now on
+	conn.pool.Lock()
+	defer conn.pool.Unlock()
+
+	if conn.entryCache != nil {
+		// clients still leased keep their own reference to the cache
+		DeleteEntryCache(conn.entryCache)
+		conn.entryCache = nil
+	}
+	if conn.negativeCache != nil {
+		DeleteNegativeCache(conn.negativeCache)
+		conn.negativeCache = nil
+	}
 }
 
 // StartTLS sends the command to start a TLS session and then creates a new TLS Client
@@ -45,55 +226,121 @@ func (conn *Conn) StartTLS(config *tls.Config) error {
 }
 
 // DigestMD5Bind performs the digest-md5 bind operation defined in the given request.
-func (l *Conn) DigestMD5Bind(username, password string) (err error) {
-	defer Recover(&err)
+func (conn *Conn) DigestMD5Bind(username, password string) error {
+	return conn.pool.setDial(func() (Client, error) {
+		return conn.newClient(func(params ClientConnParams) {
+			params.SetBinddn(username)
+			params.SetBindpw(password)
+			params.SetSecured(true)
+			params.SetUse_gssapi(false)
+			params.SetUse_tls(false)
+			params.SetUse_ldaps(false)
+		})
+	})
+}
+
+// GSSAPIBind performs the GSSAPI SASL bind using the provided GSSAPI client.
+func (conn *Conn) GSSAPIBind(realm, keytab_name string) error {
+	return conn.pool.setDial(func() (Client, error) {
+		return conn.newClient(func(params ClientConnParams) {
+			params.SetDomain(realm)
+			params.SetSecured(true)
+			params.SetUse_gssapi(true)
+			params.SetUse_tls(false)
+			params.SetUse_ldaps(false)
+			params.SetKrb5_keytab_name(keytab_name)
+		})
+	})
+}
 
+// newClient creates a client and binds it with the connection params, completed by setup
+func (conn *Conn) newClient(setup func(params ClientConnParams)) (client Client, err error) {
 	params := NewClientConnParams()
 	defer DeleteClientConnParams(params)
 
-	params.SetBinddn(username)
-	params.SetBindpw(password)
 	params.SetNettimeout(conn.netTimeout)
 	params.SetTimelimit(conn.timeLimit)
-	params.SetSecured(true)
-	params.SetUse_gssapi(false)
-	params.SetUse_tls(false)
-	params.SetUse_ldaps(false)
+	conn.setPaging(params)
 
-	uries := NewStringVector()
+	uries := slice2vector(append([]string{conn.addr}, conn.fallbackAddrs...))
 	defer DeleteStringVector(uries)
 
-	uries.Add(conn.addr)
 	params.SetUries(uries)
+	if conn.connectStagger > 0 {
+		stagger := int(conn.connectStagger.Milliseconds())
+		if stagger < 1 {
+			stagger = 1
+		}
+		params.SetConnect_stagger_ms(stagger)
+	}
+	if conn.probeTimeout > 0 {
+		params.SetProbe_timeout_ms(int(conn.probeTimeout.Milliseconds()))
+	}
+	params.SetRead_retries(conn.readRetries)
+	if conn.maxRangeValues > 0 {
+		params.SetMax_range_values(int64(conn.maxRangeValues))
+	}
+	if conn.lookupWindow > 0 {
+		params.SetLookup_window(conn.lookupWindow)
+	}
+	if conn.keepAlive > 0 {
+		idle := int(conn.keepAlive.Seconds())
+		if idle < 1 {
+			idle = 1
+		}
+		params.SetKeepalive_idle(idle)
+		params.SetKeepalive_interval(idle)
+	}
 
-	conn.client.Bind(params)
+	setup(params)
 
-	return nil
-}
+	client = NewClient()
+	installLogger(client)
 
-// GSSAPIBind performs the GSSAPI SASL bind using the provided GSSAPI client.
-func (conn *Conn) GSSAPIBind(realm, keytab_name string) (err error) {
+	defer func() {
+		if err != nil {
+			DeleteClient(client)
+			client = nil
+		}
+	}()
 	defer Recover(&err)
 
-	params := NewClientConnParams()
-	defer DeleteClientConnParams(params)
+	if !conn.shareCaches(client) {
+		return nil, errPoolClosed
+	}
+	client.Bind(params)
 
-	params.SetDomain(realm)
-	params.SetNettimeout(conn.netTimeout)
-	params.SetTimelimit(conn.timeLimit)
-	params.SetSecured(true)
-	params.SetUse_gssapi(true)
-	params.SetUse_tls(false)
-	params.SetUse_ldaps(false)
-	params.SetKrb5_keytab_name(keytab_name)
+	return client, nil
+}
 
-	uries := NewStringVector()
-	defer DeleteStringVector(uries)
+// shareCaches hands the caches of the connection to client. It returns false if the
+// connection is closed, the pool lock keeps Close from deleting the caches meanwhile.
+func (conn *Conn) shareCaches(client Client) bool {
+	conn.pool.Lock()
+	defer conn.pool.Unlock()
 
-	uries.Add(conn.addr)
-	params.SetUries(uries)
+	if conn.pool.closed {
+		return false
+	}
+	if conn.entryCache != nil {
+		client.SetEntryCache(conn.entryCache)
+	}
+	if conn.negativeCache != nil {
+		client.SetNegativeCache(conn.negativeCache)
+	}
+	return true
+}
 
-	conn.client.Bind(params)
+// lease runs fn with a client leased from the pool, C++ exceptions thrown by fn are returned as errors
+func (conn *Conn) lease(fn func(client Client)) (err error) {
+	pc, err := conn.pool.get()
+	if err != nil {
+		return err
+	}
+	defer func() { conn.pool.put(pc, err) }()
+	defer Recover(&err)
+
+	fn(pc.client)
 
 	return nil
 }
@@ -108,7 +355,13 @@ func DialURL(addr string, opts ...DialOpt) (*Conn, error) {
 		return nil, NewError(ErrorNetwork, err)
 	}
 
-	var dc DialContext
+	dc := DialContext{
+		poolMinSize:             DefaultPoolMinSize,
+		poolMaxSize:             DefaultPoolMaxSize,
+		poolIdleTimeout:         DefaultPoolIdleTimeout,
+		poolHealthCheckInterval: DefaultPoolHealthCheckInterval,
+		readRetries:             1,
+	}
 	for _, opt := range opts {
 		opt(&dc)
 	}
@@ -116,15 +369,44 @@ func DialURL(addr string, opts ...DialOpt) (*Conn, error) {
 		dc.dialer = &net.Dialer{Timeout: DefaultTimeout}
 	}
 
-	client := NewClient()
-	if logger != nil {
-		client.SetLogger(NewDirectorClientLogger(logger))
+	var entryCache EntryCache
+	if dc.entryCacheBytes > 0 && dc.entryCacheTTL > 0 {
+		ttl := int(dc.entryCacheTTL.Seconds())
+		if ttl < 1 {
+			ttl = 1
+		}
+		entryCache = NewEntryCache(dc.entryCacheBytes, ttl)
+	}
+	var negativeCache NegativeCache
+	if dc.negativeCacheSize > 0 && dc.negativeCacheTTL > 0 {
+		ttl := int(dc.negativeCacheTTL.Seconds())
+		if ttl < 1 {
+			ttl = 1
+		}
+		negativeCache = NewNegativeCache(int64(dc.negativeCacheSize), ttl)
 	}
 
 	return &Conn{
-		client:     client,
-		addr:       u.Host,
+		pool:          newPool(&dc),
+		addr:          u.Host,
+		names:         sharedAttributeNames,
+		entryCache:    entryCache,
+		negativeCache: negativeCache,
+
+		fallbackAddrs:  dc.fallbackAddrs,
+		connectStagger: dc.connectStagger,
+		probeTimeout:   dc.probeTimeout,
+		readRetries:    dc.readRetries,
+		keepAlive:      dc.keepAlive,
+
 		netTimeout: int(dc.dialer.Timeout.Seconds()),
 		timeLimit:  -1,
+
+		pageSize:         dc.pageSize,
+		maxPageSize:      dc.maxPageSize,
+		pageMemoryBudget: dc.pageMemoryBudget,
+
+		maxRangeValues: dc.maxRangeValues,
+		lookupWindow:   dc.lookupWindow,
 	}, nil
 }
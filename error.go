@@ -199,7 +199,7 @@ func Recover(err *error) {
 			msg = err_splitted[1]
 
 			if code, code_err := strconv.Atoi(err_splitted[0]); code_err == nil {
-				resultCode = uint16(code)
+				resultCode = ldapResultCode(code)
 			}
 		}
 
@@ -211,6 +211,16 @@ func Recover(err *error) {
 	}
 }
 
+// ldapResultCode returns the result code of libldap code.
+func ldapResultCode(code int) uint16 {
+	// libldap reports client side errors with negative codes,
+	// -1 (server down) .. -17 (referral limit exceeded) map to 81 .. 97
+	if code < 0 && code >= -17 {
+		code = 80 - code
+	}
+	return uint16(code)
+}
+
 // NewError creates an LDAP error with the given code and underlying error
 func NewError(resultCode uint16, err error) error {
 	return &Error{ResultCode: resultCode, Msg: err.Error()}
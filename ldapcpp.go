@@ -1,12 +1,35 @@
 package ldapcpp
 
 // #cgo CPPFLAGS: -Isrc -DOPENLDAP -DKRB5 -Wno-deprecated
-// #cgo LDFLAGS: -Lbuild -lclient -lstdc++ -lldap -lsasl2 -lstdc++ -llber -lresolv -lkrb5
+// #cgo CXXFLAGS: -std=c++17
+// #cgo LDFLAGS: -Lbuild -lclient -lstdc++ -lldap -lsasl2 -lstdc++ -llber -lresolv -lkrb5 -lgssapi_krb5 -lpthread
 import "C"
 
+import "sync"
+
 var logger Logger
 
+// installed is the logger, that C++ side is using. The C++ logger is process-wide,
+// so it is replaced only when SetLogger was called with another one.
+var installed struct {
+	sync.Mutex
+	logger Logger
+}
+
 // SetLogger sets logger
 func SetLogger(l Logger) {
+	installed.Lock()
+	defer installed.Unlock()
+
 	logger = l
 }
+
+func installLogger(client Client) {
+	installed.Lock()
+	defer installed.Unlock()
+
+	if logger != nil && logger != installed.logger {
+		client.SetLogger(NewDirectorClientLogger(logger))
+		installed.logger = logger
+	}
+}
@@ -0,0 +1,176 @@
+package ldapcpp
+
+import (
+	"errors"
+	"sync"
+	"time"
+)
+
+// change types of ChangeEvent
+const (
+	// ChangeMissed means, that changes could have been missed while the listener was reconnecting
+	ChangeMissed = 0
+	ChangeAdd    = 1
+	ChangeDelete = 2
+	ChangeModify = 4
+	ChangeModDN  = 8
+	ChangeAny    = ChangeAdd | ChangeDelete | ChangeModify | ChangeModDN
+)
+
+// listen modes
+const (
+	// ListenAuto uses change notification on Active Directory, persistent search otherwise
+	ListenAuto = 0
+	// ListenNotification uses the Active Directory LDAP_SERVER_NOTIFICATION control.
+	// It reports additions and renames as ChangeModify, Filter must be "(objectclass=*)".
+	ListenNotification = 1
+	// ListenPersistent uses persistent search
+	ListenPersistent = 2
+)
+
+// DefaultListenBuffer is the number of change events, that a listener keeps until they are received
+var DefaultListenBuffer = 256
+
+// ListenRequest describes the part of the directory, whose changes are listened for
+type ListenRequest struct {
+	BaseDN string
+	Scope  int
+	Filter string
+	// Attributes of changed entries, objectGUID is added with ListenNotification
+	Attributes []string
+	Mode       int
+	// ChangeTypes is a mask of persistent search change types, ChangeAny if 0
+	ChangeTypes int
+	// RetryInterval is the delay between attempts to listen again after the session was lost
+	RetryInterval time.Duration
+}
+
+// ChangeEvent is a change of an object
+type ChangeEvent struct {
+	Type int
+	DN   string
+	// PreviousDN is the DN before ChangeModDN, if the server has sent it
+	PreviousDN string
+	// Entry is the changed object with requested attributes
+	Entry *Entry
+	// Err tells why changes could have been missed (ChangeMissed)
+	Err error
+}
+
+// Listener delivers changes of the directory, it listens on its own connection.
+// Cached lookups of changed objects are dropped from the caches of the connection.
+type Listener struct {
+	client   Client
+	handler  ChangeHandler
+	listener ChangeListener
+
+	events    chan *ChangeEvent
+	done      chan struct{}
+	closeOnce sync.Once
+}
+
+// listenerHandler passes notifications of C++ listener thread to the events channel
+type listenerHandler struct {
+	l     *Listener
+	names *attributeNames
+}
+
+func (h *listenerHandler) Notify(notification ChangeNotification) {
+	event := &ChangeEvent{
+		Type:       notification.GetType(),
+		DN:         notification.GetDn(),
+		PreviousDN: notification.GetPrevious_dn(),
+	}
+	entries, err := newEntries(notification.GetEntry(), h.names)
+	if err == nil && len(entries) > 0 {
+		event.Entry = entries[0]
+	}
+	h.send(event)
+}
+
+func (h *listenerHandler) Missed(reason string) {
+	h.send(&ChangeEvent{
+		Type: ChangeMissed,
+		Err:  NewError(ErrorNetwork, errors.New(reason)),
+	})
+}
+
+// send blocks the listener until the event is received, or the listener is closed
+func (h *listenerHandler) send(event *ChangeEvent) {
+	select {
+	case h.l.events <- event:
+	case <-h.l.done:
+	}
+}
+
+// Listen starts listening for changes of the request, on a newly bound client.
+func (conn *Conn) Listen(req *ListenRequest) (l *Listener, err error) {
+	client, err := conn.pool.dedicated()
+	if err != nil {
+		return nil, err
+	}
+
+	l = &Listener{
+		client: client,
+		events: make(chan *ChangeEvent, DefaultListenBuffer),
+		done:   make(chan struct{}),
+	}
+	l.handler = NewDirectorChangeHandler(&listenerHandler{l: l, names: conn.names})
+
+	defer func() {
+		if err != nil {
+			l.Close()
+			l = nil
+		}
+	}()
+	defer Recover(&err)
+
+	params := NewChangeListenerParams()
+	defer DeleteChangeListenerParams(params)
+
+	cAttrs := slice2vector(req.Attributes)
+	defer DeleteStringVector(cAttrs)
+
+	params.SetMode(req.Mode)
+	params.SetSearch_base(req.BaseDN)
+	params.SetScope(req.Scope)
+	if req.Filter != "" {
+		params.SetFilter(req.Filter)
+	}
+	params.SetAttributes(cAttrs)
+	if req.ChangeTypes != 0 {
+		params.SetChange_types(req.ChangeTypes)
+	}
+	if req.RetryInterval > 0 {
+		interval := int(req.RetryInterval.Seconds())
+		if interval < 1 {
+			interval = 1
+		}
+		params.SetRetry_interval(interval)
+	}
+
+	l.listener = NewChangeListener(client, params, l.handler)
+	l.listener.Start()
+
+	return l, nil
+}
+
+// Events returns the channel of change events, it is closed when the listener is closed.
+// The listener waits while the channel is full, so it must be drained.
+func (l *Listener) Events() <-chan *ChangeEvent {
+	return l.events
+}
+
+// Close stops listening and closes the connection of the listener.
+func (l *Listener) Close() {
+	l.closeOnce.Do(func() {
+		close(l.done)
+		if l.listener != nil {
+			l.listener.Stop()
+			DeleteChangeListener(l.listener)
+		}
+		DeleteDirectorChangeHandler(l.handler)
+		DeleteClient(l.client)
+		close(l.events)
+	})
+}
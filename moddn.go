@@ -46,18 +46,45 @@ func NewModifyDNWithControlsRequest(dn string, rdn string, delOld bool, newSup s
 
 // ModifyDN renames the given DN and optionally move to another base (when the "newSup" argument
 // to NewModifyDNRequest() is not "").
-func (conn *Conn) ModifyDN(req *ModifyDNRequest) (err error) {
-	conn.Lock()
-	defer conn.Unlock()
+func (conn *Conn) ModifyDN(req *ModifyDNRequest) error {
+	var deleteOldRDN int
+	if req.DeleteOldRDN {
+		deleteOldRDN = 1
+	}
 
-	defer Recover(&err)
+	return conn.lease(func(client Client) {
+		client.ModifyDN(req.DN, req.NewRDN, req.NewSuperior, deleteOldRDN)
+	})
+}
+
+// ModifyDNAsync sends the ModifyDNRequest without waiting for the response
+func (conn *Conn) ModifyDNAsync(req *ModifyDNRequest) *Future {
+	f := newFuture()
 
 	var deleteOldRDN int
 	if req.DeleteOldRDN {
 		deleteOldRDN = 1
 	}
 
-	conn.client.ModifyDN(req.DN, req.NewRDN, req.NewSuperior, deleteOldRDN)
+	pc, msgid, err := conn.submit(func(client Client) int {
+		return client.AsyncModifyDN(req.DN, req.NewRDN, req.NewSuperior, deleteOldRDN)
+	})
+	if err != nil {
+		f.err = err
+		close(f.done)
+		return f
+	}
+
+	go func() {
+		defer close(f.done)
+
+		result, err := conn.wait(pc, msgid)
+		if err != nil {
+			f.err = err
+			return
+		}
+		DeleteAsyncResult(result)
+	}()
 
-	return nil
+	return f
 }
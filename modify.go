@@ -10,33 +10,53 @@ const (
 	ReplaceAttribute = C.LDAP_MOD_REPLACE
 )
 
-// Modify performs the ModifyRequest
+// Modify performs the ModifyRequest. All changes are sent in a single request,
+// so they are applied atomically.
 func (conn *Conn) Modify(req *ModifyRequest) error {
-	for _, change := range req.Changes {
-		if err := conn.modifyChange(req.DN, change.Operation, change.Modification.Type, change.Modification.Vals); err != nil {
-			return err
-		}
+	if len(req.Changes) == 0 {
+		return nil
 	}
 
-	return nil
-}
+	return conn.lease(func(client Client) {
+		mods := req.modifications()
+		defer DeleteModificationVector(mods)
 
-func (conn *Conn) modifyChange(dn string, mod_op uint, attr string, vals []string) (err error) {
-	conn.Lock()
-	defer conn.Unlock()
+		client.Modify(req.DN, mods)
+	})
+}
 
-	defer Recover(&err)
+// ModifyAsync sends the ModifyRequest without waiting for the response
+func (conn *Conn) ModifyAsync(req *ModifyRequest) *Future {
+	f := newFuture()
+	if len(req.Changes) == 0 {
+		close(f.done)
+		return f
+	}
 
-	cVals := NewStringVector()
-	defer DeleteStringVector(cVals)
+	pc, msgid, err := conn.submit(func(client Client) int {
+		mods := req.modifications()
+		defer DeleteModificationVector(mods)
 
-	for _, val := range vals {
-		cVals.Add(val)
+		return client.AsyncModify(req.DN, mods)
+	})
+	if err != nil {
+		f.err = err
+		close(f.done)
+		return f
 	}
 
-	conn.client.Modify(dn, int(mod_op), attr, cVals)
+	go func() {
+		defer close(f.done)
 
-	return nil
+		result, err := conn.wait(pc, msgid)
+		if err != nil {
+			f.err = err
+			return
+		}
+		DeleteAsyncResult(result)
+	}()
+
+	return f
 }
 
 // PartialAttribute for a ModifyRequest as defined in https://tools.ietf.org/html/rfc4511
@@ -82,6 +102,19 @@ func (req *ModifyRequest) appendChange(operation uint, attrType string, attrVals
 	req.Changes = append(req.Changes, Change{operation, PartialAttribute{Type: attrType, Vals: attrVals}})
 }
 
+// modifications returns a new ModificationVector, that must be deleted by the caller
+func (req *ModifyRequest) modifications() ModificationVector {
+	mods := NewModificationVector()
+	for _, change := range req.Changes {
+		cVals := slice2vector(change.Modification.Vals)
+		mod := NewClientModification(int(change.Operation), change.Modification.Type, cVals)
+		mods.Add(mod)
+		DeleteClientModification(mod)
+		DeleteStringVector(cVals)
+	}
+	return mods
+}
+
 // NewModifyRequest creates a modify request for the given DN
 func NewModifyRequest(dn string) *ModifyRequest {
 	return &ModifyRequest{
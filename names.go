@@ -0,0 +1,158 @@
+package ldapcpp
+
+import (
+	"strings"
+	"sync"
+)
+
+// attributeName is an interned spelling of an attribute name
+type attributeName struct {
+	name string
+	// id is shared by all spellings, that are equal ignoring case, 0 for names with
+	// options and names of attributes built by callers
+	id int
+}
+
+// localName is the id, that the C++ table gives to names with options
+const localName = 1<<32 - 1
+
+// attributeNames interns attribute names returned by servers. It mirrors the process-wide
+// C++ table (attributeNames in src/client.h), that sends its ids with every result set,
+// so names already seen are found by id, without hashing or folding them. Names are
+// matched case-insensitively by id, ids are folded names.
+type attributeNames struct {
+	sync.RWMutex
+
+	// names by C++ id, id is 0 for ids not seen yet
+	byID      []attributeName
+	spellings map[string]attributeName
+	// ids by lower-case name
+	folded map[string]int
+}
+
+// sharedAttributeNames is used by all connections, as the C++ table is shared by all clients
+var sharedAttributeNames = newAttributeNames()
+
+func newAttributeNames() *attributeNames {
+	return &attributeNames{
+		spellings: make(map[string]attributeName),
+		folded:    make(map[string]int),
+	}
+}
+
+// intern returns the interned spelling of name, that has id cid in the C++ table. Names
+// with options ("member;range=0-1499") have countless spellings, they are copied with
+// id 0 instead, so the table stays bounded.
+func (t *attributeNames) intern(name string, cid int) attributeName {
+	if cid == localName {
+		return attributeName{name: string([]byte(name))}
+	}
+
+	t.RLock()
+	var n attributeName
+	if cid < len(t.byID) {
+		n = t.byID[cid]
+	}
+	t.RUnlock()
+	if n.id != 0 {
+		return n
+	}
+
+	t.Lock()
+	defer t.Unlock()
+
+	n = t.add(name)
+	for len(t.byID) <= cid {
+		t.byID = append(t.byID, attributeName{})
+	}
+	t.byID[cid] = n
+	return n
+}
+
+// lookup returns id of name, ok is false if no server returned such a name. Spellings
+// of callers are folded under the read lock and never added, so they do not grow the table.
+func (t *attributeNames) lookup(name string) (id int, ok bool) {
+	t.RLock()
+	defer t.RUnlock()
+
+	if n, spelled := t.spellings[name]; spelled {
+		return n.id, true
+	}
+	id, ok = t.folded[strings.ToLower(name)]
+	return id, ok
+}
+
+// add interns the spelling, table must be locked
+func (t *attributeNames) add(name string) attributeName {
+	if n, ok := t.spellings[name]; ok {
+		return n
+	}
+
+	// names could be substrings of a large result buffer, do not keep it alive
+	name = string([]byte(name))
+	key := strings.ToLower(name)
+
+	id, ok := t.folded[key]
+	if !ok {
+		id = len(t.folded) + 1
+		t.folded[key] = id
+	}
+
+	n := attributeName{name: name, id: id}
+	t.spellings[name] = n
+	return n
+}
+
+// attributeIndex is a hash table of entry attributes by name id
+type attributeIndex struct {
+	names *attributeNames
+	// attribute position + 1 by slot, 0 is an empty slot
+	slots []int32
+	shift uint
+	// number of indexed attributes, index is not used if attributes were added or removed
+	size int
+}
+
+func newAttributeIndex(names *attributeNames, attrs []*EntryAttribute) *attributeIndex {
+	bits := uint(1)
+	for 1<<bits < 2*len(attrs) {
+		bits++
+	}
+	index := &attributeIndex{
+		names: names,
+		slots: make([]int32, 1<<bits),
+		shift: 32 - bits,
+		size:  len(attrs),
+	}
+	for i, attr := range attrs {
+		slot := index.slot(attr.id)
+		for index.slots[slot] != 0 {
+			slot = (slot + 1) & (len(index.slots) - 1)
+		}
+		index.slots[slot] = int32(i + 1)
+	}
+	return index
+}
+
+func (index *attributeIndex) slot(id int) int {
+	return int((uint32(id) * 2654435769) >> index.shift)
+}
+
+// find returns the attribute named name ignoring case, or nil. Attributes could have
+// been reordered or replaced since the index was built, so the id of a found
+// attribute is checked, and nil does not mean that attrs have no such attribute.
+func (index *attributeIndex) find(attrs []*EntryAttribute, name string) *EntryAttribute {
+	if strings.IndexByte(name, ';') >= 0 {
+		return nil
+	}
+	id, ok := index.names.lookup(name)
+	if !ok {
+		return nil
+	}
+	for slot := index.slot(id); index.slots[slot] != 0; slot = (slot + 1) & (len(index.slots) - 1) {
+		if attr := attrs[index.slots[slot]-1]; attr.id == id {
+			return attr
+		}
+	}
+	return nil
+}
@@ -0,0 +1,238 @@
+package ldapcpp
+
+import "sync"
+
+// DefaultLookupClients is the number of pooled clients, that GetObjectsAttributes uses at once
+var DefaultLookupClients = 4
+
+// minimum number of objects, that GetObjectsAttributes looks up on a single client
+const minClientLookups = 32
+
+// ObjectAttributes is the result of lookup of a single object of GetObjectsAttributes
+type ObjectAttributes struct {
+	Attributes map[string][]string
+	// Err tells why the object could not be looked up
+	Err error
+}
+
+// EntryCacheStats are counters of the connection entry cache and negative cache
+type EntryCacheStats struct {
+	Hits      int64
+	Misses    int64
+	Evictions int64
+	// Entries is the number of cached lookups, Bytes is their estimated size
+	Entries int64
+	Bytes   int64
+
+	// lookups failed from the negative cache, lookups not found in it, and its size
+	NegativeHits    int64
+	NegativeMisses  int64
+	NegativeEntries int64
+}
+
+// GetObjectAttributes returns the given attributes (all of them, if none are given)
+// of the object dn. It is answered from the entry cache and the negative cache, if enabled.
+func (conn *Conn) GetObjectAttributes(dn string, attributes ...string) (attrs map[string][]string, err error) {
+	if len(attributes) == 0 {
+		attributes = []string{"*"}
+	}
+
+	err = conn.lease(func(client Client) {
+		cAttributes := slice2vector(attributes)
+		defer DeleteStringVector(cAttributes)
+
+		result := client.GetObjectAttributes(dn, cAttributes)
+		defer DeleteString_VectorString_Map(result)
+
+		attrs = newAttributesMap(result)
+	})
+	if err != nil {
+		return nil, err
+	}
+	return attrs, nil
+}
+
+// GetObjectsAttributes returns the given attributes (all of them, if none are given) of each
+// object of dns, keyed by DN as given. Objects are split among up to DefaultLookupClients
+// pooled clients, each of them pipelines base searches of its objects. A failed lookup
+// is reported in Err of its object, the returned error means the whole call has failed.
+func (conn *Conn) GetObjectsAttributes(dns []string, attributes ...string) (map[string]*ObjectAttributes, error) {
+	if len(attributes) == 0 {
+		attributes = []string{"*"}
+	}
+
+	unique := make([]string, 0, len(dns))
+	seen := make(map[string]bool, len(dns))
+	for _, dn := range dns {
+		if !seen[dn] {
+			seen[dn] = true
+			unique = append(unique, dn)
+		}
+	}
+
+	clients := (len(unique) + minClientLookups - 1) / minClientLookups
+	if clients > DefaultLookupClients {
+		clients = DefaultLookupClients
+	}
+	if clients < 1 {
+		clients = 1
+	}
+	chunk := (len(unique) + clients - 1) / clients
+
+	var (
+		mu       sync.Mutex
+		wg       sync.WaitGroup
+		firstErr error
+	)
+	results := make(map[string]*ObjectAttributes, len(unique))
+	for start := 0; start < len(unique); start += chunk {
+		end := start + chunk
+		if end > len(unique) {
+			end = len(unique)
+		}
+
+		wg.Add(1)
+		go func(part []string) {
+			defer wg.Done()
+
+			found, err := conn.getObjectsAttributes(part, attributes)
+
+			mu.Lock()
+			defer mu.Unlock()
+			if err != nil {
+				if firstErr == nil {
+					firstErr = err
+				}
+				return
+			}
+			for dn, result := range found {
+				results[dn] = result
+			}
+		}(unique[start:end])
+	}
+	wg.Wait()
+
+	if firstErr != nil {
+		return nil, firstErr
+	}
+	return results, nil
+}
+
+func (conn *Conn) getObjectsAttributes(dns []string, attributes []string) (results map[string]*ObjectAttributes, err error) {
+	err = conn.lease(func(client Client) {
+		cDNs := slice2vector(dns)
+		defer DeleteStringVector(cDNs)
+		cAttributes := slice2vector(attributes)
+		defer DeleteStringVector(cAttributes)
+
+		found := client.GetObjectsAttributes(cDNs, cAttributes)
+		defer DeleteString_LookupResult_Map(found)
+
+		keys := found.Keys()
+		defer DeleteStringVector(keys)
+
+		results = make(map[string]*ObjectAttributes, keys.Size())
+		for i := 0; i < int(keys.Size()); i++ {
+			dn := keys.Get(i)
+			lookup := found.Get(dn)
+
+			result := &ObjectAttributes{}
+			if code := lookup.GetCode(); code != LDAPResultSuccess {
+				result.Err = Error{Msg: lookup.GetError_msg(), ResultCode: ldapResultCode(code)}
+			} else {
+				result.Attributes = newAttributesMap(lookup.GetAttributes())
+			}
+			results[dn] = result
+		}
+	})
+	return results, err
+}
+
+// ResolveAttribute returns the values of attribute of each object of dns, keyed by DN as given.
+// Objects are looked up with base searches pipelined over a single client, each of them once.
+// Objects, that are missing or have no such attribute, are left out of the result.
+func (conn *Conn) ResolveAttribute(dns []string, attribute string) (values map[string][]string, err error) {
+	err = conn.lease(func(client Client) {
+		cDNs := slice2vector(dns)
+		defer DeleteStringVector(cDNs)
+
+		result := client.ResolveAttribute(cDNs, attribute)
+		defer DeleteString_VectorString_Map(result)
+
+		values = newAttributesMap(result)
+	})
+	if err != nil {
+		return nil, err
+	}
+	return values, nil
+}
+
+// DNExists reports whether the object dn exists. It is answered from the entry cache and
+// the negative cache, if enabled.
+func (conn *Conn) DNExists(dn string) (exists bool, err error) {
+	err = conn.lease(func(client Client) {
+		exists = client.IfDNExists(dn)
+	})
+	return exists, err
+}
+
+// newAttributesMap copies map of values keyed by name
+func newAttributesMap(values String_VectorString_Map) map[string][]string {
+	keys := values.Keys()
+	defer DeleteStringVector(keys)
+
+	result := make(map[string][]string, keys.Size())
+	for i := 0; i < int(keys.Size()); i++ {
+		name := keys.Get(i)
+		result[name] = vector2slice(values.Get(name))
+	}
+	return result
+}
+
+// DNsExist reports whether each object of dns exists, keyed by DN as given. Objects are looked
+// up with base searches pipelined over a single client, each of them once. Lookups share
+// the entry cache and the negative cache with DNExists.
+func (conn *Conn) DNsExist(dns []string) (exists map[string]bool, err error) {
+	err = conn.lease(func(client Client) {
+		cDNs := slice2vector(dns)
+		defer DeleteStringVector(cDNs)
+
+		result := client.Exists(cDNs)
+		defer DeleteStringBoolMap(result)
+
+		keys := result.Keys()
+		defer DeleteStringVector(keys)
+
+		exists = make(map[string]bool, keys.Size())
+		for i := 0; i < int(keys.Size()); i++ {
+			dn := keys.Get(i)
+			exists[dn] = result.Get(dn)
+		}
+	})
+	if err != nil {
+		return nil, err
+	}
+	return exists, nil
+}
+
+// EntryCacheStats returns counters of the entry cache and the negative cache,
+// counters of a disabled cache are zero.
+func (conn *Conn) EntryCacheStats() (stats EntryCacheStats) {
+	// Close deletes the caches under the pool lock
+	conn.pool.Lock()
+	defer conn.pool.Unlock()
+
+	if conn.entryCache != nil {
+		stats.Hits = conn.entryCache.Hits()
+		stats.Misses = conn.entryCache.Misses()
+		stats.Evictions = conn.entryCache.Evictions()
+		stats.Entries = conn.entryCache.Size()
+		stats.Bytes = conn.entryCache.Bytes()
+	}
+	if conn.negativeCache != nil {
+		stats.NegativeHits = conn.negativeCache.Hits()
+		stats.NegativeMisses = conn.negativeCache.Misses()
+		stats.NegativeEntries = conn.negativeCache.Size()
+	}
+	return stats
+}
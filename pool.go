@@ -0,0 +1,408 @@
+package ldapcpp
+
+import (
+	"errors"
+	"sync"
+	"time"
+)
+
+// Pool defaults, used when DialURL has no pool options
+var (
+	DefaultPoolMinSize             = 1
+	DefaultPoolMaxSize             = 1
+	DefaultPoolIdleTimeout         = 5 * time.Minute
+	DefaultPoolHealthCheckInterval = time.Minute
+)
+
+// DialWithPoolSize sets the number of bound clients behind the connection.
+// minSize clients are kept open, up to maxSize operations run concurrently.
+func DialWithPoolSize(minSize, maxSize int) DialOpt {
+	return func(dc *DialContext) {
+		dc.poolMinSize = minSize
+		dc.poolMaxSize = maxSize
+	}
+}
+
+// DialWithPoolIdleTimeout sets how long a client above the minimal pool size
+// may stay unused before it is closed. Zero disables idle eviction.
+func DialWithPoolIdleTimeout(timeout time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.poolIdleTimeout = timeout
+	}
+}
+
+// DialWithPoolHealthCheck sets how often idle clients are probed with a rootDSE
+// read, dead ones are replaced. Zero disables health checks.
+func DialWithPoolHealthCheck(interval time.Duration) DialOpt {
+	return func(dc *DialContext) {
+		dc.poolHealthCheckInterval = interval
+	}
+}
+
+var (
+	errPoolClosed = NewError(ErrorNetwork, errors.New("connection is closed"))
+	errNotBound   = NewError(ErrorNetwork, errors.New("connection is not bound"))
+)
+
+// pooledClient is a bound client, owned by the pool
+type pooledClient struct {
+	client   Client
+	lastUsed time.Time
+	// bind generation, clients of an older bind are closed when they come back
+	gen int
+	// async requests in flight, the client is not deleted until they are complete
+	inflight int
+	retired  bool
+}
+
+// pool keeps bound clients and leases them to operations, one operation per client at a time
+type pool struct {
+	sync.Mutex
+	cond *sync.Cond
+
+	minSize             int
+	maxSize             int
+	idleTimeout         time.Duration
+	healthCheckInterval time.Duration
+
+	// dial creates a new bound client, it is nil until the connection is bound
+	dial func() (Client, error)
+	gen  int
+
+	// idle clients, the most recently used is the last one
+	idle []*pooledClient
+	// idle and leased clients
+	size int
+
+	closed bool
+	stop   chan struct{}
+}
+
+func newPool(dc *DialContext) *pool {
+	p := &pool{
+		minSize:             dc.poolMinSize,
+		maxSize:             dc.poolMaxSize,
+		idleTimeout:         dc.poolIdleTimeout,
+		healthCheckInterval: dc.poolHealthCheckInterval,
+		stop:                make(chan struct{}),
+	}
+	p.cond = sync.NewCond(p)
+
+	if p.maxSize < 1 {
+		p.maxSize = 1
+	}
+	if p.minSize > p.maxSize {
+		p.minSize = p.maxSize
+	}
+
+	go p.maintain()
+
+	return p
+}
+
+// setDial replaces the way clients are bound. The first client is bound right
+// away to report bind errors, clients of the previous bind are closed.
+func (p *pool) setDial(dial func() (Client, error)) error {
+	client, err := dial()
+	if err != nil {
+		return err
+	}
+
+	p.Lock()
+	defer p.Unlock()
+
+	if p.closed {
+		DeleteClient(client)
+		return errPoolClosed
+	}
+
+	for _, pc := range p.idle {
+		p.retire(pc)
+	}
+	p.size -= len(p.idle)
+	p.idle = nil
+
+	p.gen++
+	p.dial = dial
+	p.size++
+	p.idle = append(p.idle, &pooledClient{client: client, lastUsed: time.Now(), gen: p.gen})
+	p.cond.Broadcast()
+
+	go p.fill()
+
+	return nil
+}
+
+// get leases a client, binding a new one if the pool is not full, or waits for a free one
+func (p *pool) get() (*pooledClient, error) {
+	p.Lock()
+	defer p.Unlock()
+
+	for {
+		if p.closed {
+			return nil, errPoolClosed
+		}
+		if p.dial == nil {
+			return nil, errNotBound
+		}
+		if n := len(p.idle); n > 0 {
+			pc := p.idle[n-1]
+			p.idle = p.idle[:n-1]
+			return pc, nil
+		}
+		if p.size < p.maxSize {
+			p.size++
+			dial, gen := p.dial, p.gen
+
+			p.Unlock()
+			client, err := dial()
+			p.Lock()
+
+			if err != nil {
+				p.size--
+				p.cond.Signal()
+				return nil, err
+			}
+			return &pooledClient{client: client, lastUsed: time.Now(), gen: gen}, nil
+		}
+		p.cond.Wait()
+	}
+}
+
+// dedicated binds a client with the current bind, that is owned by the caller and not pooled
+func (p *pool) dedicated() (Client, error) {
+	p.Lock()
+	dial, closed := p.dial, p.closed
+	p.Unlock()
+
+	if closed {
+		return nil, errPoolClosed
+	}
+	if dial == nil {
+		return nil, errNotBound
+	}
+	return dial()
+}
+
+// put returns a leased client, the client is closed if err shows it is not usable anymore
+func (p *pool) put(pc *pooledClient, err error) {
+	p.Lock()
+	defer p.Unlock()
+
+	if p.closed || pc.gen != p.gen || isConnectionError(err) {
+		p.size--
+		p.retire(pc)
+	} else {
+		pc.lastUsed = time.Now()
+		p.idle = append(p.idle, pc)
+	}
+	p.cond.Signal()
+}
+
+// track counts an async request sent with the leased client
+func (p *pool) track(pc *pooledClient) {
+	p.Lock()
+	defer p.Unlock()
+
+	pc.inflight++
+}
+
+// done marks tracked async request complete
+func (p *pool) done(pc *pooledClient) {
+	p.Lock()
+	defer p.Unlock()
+
+	pc.inflight--
+	if pc.retired && pc.inflight == 0 {
+		DeleteClient(pc.client)
+	}
+}
+
+// retire closes the client, once its async requests are complete. Pool must be locked.
+func (p *pool) retire(pc *pooledClient) {
+	pc.retired = true
+	if pc.inflight == 0 {
+		DeleteClient(pc.client)
+	}
+}
+
+// fill binds clients up to the minimal pool size
+func (p *pool) fill() {
+	p.Lock()
+	defer p.Unlock()
+
+	for !p.closed && p.dial != nil && p.size < p.minSize {
+		p.size++
+		dial, gen := p.dial, p.gen
+
+		p.Unlock()
+		client, err := dial()
+		p.Lock()
+
+		if err != nil {
+			p.size--
+			return
+		}
+		pc := &pooledClient{client: client, lastUsed: time.Now(), gen: gen}
+		if p.closed || gen != p.gen {
+			p.size--
+			p.retire(pc)
+			continue
+		}
+		p.idle = append(p.idle, pc)
+		p.cond.Signal()
+	}
+}
+
+func (p *pool) maintain() {
+	interval := p.healthCheckInterval
+	if interval <= 0 || (p.idleTimeout > 0 && p.idleTimeout < interval) {
+		interval = p.idleTimeout
+	}
+	if interval <= 0 {
+		return
+	}
+
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-p.stop:
+			return
+		case <-ticker.C:
+		}
+
+		p.evict()
+		if p.healthCheckInterval > 0 {
+			p.check()
+		}
+		p.fill()
+	}
+}
+
+// evict closes clients above the minimal pool size, that were not used for idleTimeout
+func (p *pool) evict() {
+	if p.idleTimeout <= 0 {
+		return
+	}
+
+	p.Lock()
+	defer p.Unlock()
+
+	now := time.Now()
+	idle := p.idle[:0]
+	for _, pc := range p.idle {
+		if p.size > p.minSize && now.Sub(pc.lastUsed) > p.idleTimeout {
+			p.size--
+			p.retire(pc)
+			continue
+		}
+		idle = append(idle, pc)
+	}
+	for i := len(idle); i < len(p.idle); i++ {
+		p.idle[i] = nil
+	}
+	p.idle = idle
+}
+
+// check probes idle clients one by one and closes dead ones
+func (p *pool) check() {
+	p.Lock()
+	candidates := append([]*pooledClient(nil), p.idle...)
+	p.Unlock()
+
+	for _, pc := range candidates {
+		p.Lock()
+		if p.closed || !p.take(pc) {
+			p.Unlock()
+			continue
+		}
+		p.Unlock()
+
+		// a client, that has lost its session, binds again rather than being replaced
+		alive := ping(pc.client) || reconnect(pc.client)
+
+		p.Lock()
+		if alive && !p.closed && pc.gen == p.gen {
+			// probes do not count as use, the client keeps its place by lastUsed
+			i := 0
+			for i < len(p.idle) && !p.idle[i].lastUsed.After(pc.lastUsed) {
+				i++
+			}
+			p.idle = append(p.idle, nil)
+			copy(p.idle[i+1:], p.idle[i:])
+			p.idle[i] = pc
+		} else {
+			p.size--
+			p.retire(pc)
+		}
+		p.cond.Signal()
+		p.Unlock()
+	}
+}
+
+// take removes the client from idle ones, if it was not leased meanwhile. Pool must be locked.
+func (p *pool) take(pc *pooledClient) bool {
+	for i := range p.idle {
+		if p.idle[i] == pc {
+			p.idle = append(p.idle[:i], p.idle[i+1:]...)
+			return true
+		}
+	}
+	return false
+}
+
+// close closes idle clients, leased ones are closed when they come back
+func (p *pool) close() {
+	p.Lock()
+	defer p.Unlock()
+
+	if p.closed {
+		return
+	}
+	p.closed = true
+	close(p.stop)
+
+	for _, pc := range p.idle {
+		p.retire(pc)
+	}
+	p.size -= len(p.idle)
+	p.idle = nil
+	p.cond.Broadcast()
+}
+
+func ping(client Client) (alive bool) {
+	defer func() {
+		if recover() != nil {
+			alive = false
+		}
+	}()
+
+	return client.Ping()
+}
+
+func reconnect(client Client) (ok bool) {
+	defer func() {
+		if recover() != nil {
+			ok = false
+		}
+	}()
+
+	client.Reconnect()
+	return true
+}
+
+// isConnectionError reports whether err means the client has lost its server
+func isConnectionError(err error) bool {
+	var code uint16
+	switch e := err.(type) {
+	case Error:
+		code = e.ResultCode
+	case *Error:
+		code = e.ResultCode
+	default:
+		return false
+	}
+	return code == LDAPResultServerDown || code == LDAPResultConnectError
+}
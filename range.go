@@ -0,0 +1,109 @@
+package ldapcpp
+
+import "sync"
+
+// AttributeStream iterates over the values of a single attribute range by range, so
+// attributes like member of large groups are never held in memory all at once.
+//
+//	stream, err := conn.AttributeStream(groupDN, "member")
+//	if err != nil {
+//		return err
+//	}
+//	defer stream.Close()
+//
+//	for stream.Next() {
+//		for _, member := range stream.Values() {
+//			...
+//		}
+//	}
+//	return stream.Err()
+type AttributeStream struct {
+	sync.Mutex
+
+	conn   *Conn
+	pc     *pooledClient
+	cursor AttributeCursor
+	values []string
+	err    error
+}
+
+// AttributeStream opens a stream of values of attribute of the object dn.
+// Servers, that do not return ranges, send all values as a single range.
+func (conn *Conn) AttributeStream(dn, attribute string) (stream *AttributeStream, err error) {
+	pc, err := conn.pool.get()
+	if err != nil {
+		return nil, err
+	}
+	defer func() {
+		if err != nil {
+			conn.pool.put(pc, err)
+		}
+	}()
+	defer Recover(&err)
+
+	return &AttributeStream{
+		conn:   conn,
+		pc:     pc,
+		cursor: pc.client.OpenAttribute(dn, attribute),
+	}, nil
+}
+
+// Next fetches the next range of values. It returns false when there are no more values or on error.
+func (s *AttributeStream) Next() bool {
+	s.Lock()
+	defer s.Unlock()
+
+	s.values = nil
+	if s.cursor == nil || s.err != nil {
+		return false
+	}
+	if !s.fetch() {
+		s.release()
+		return false
+	}
+	return true
+}
+
+func (s *AttributeStream) fetch() (more bool) {
+	defer Recover(&s.err)
+
+	if !s.cursor.Next() {
+		return false
+	}
+	s.values = vector2slice(s.cursor.Values())
+	return true
+}
+
+// Values returns the current range of values
+func (s *AttributeStream) Values() []string {
+	return s.values
+}
+
+// Err returns the error, that stopped the stream, if any
+func (s *AttributeStream) Err() error {
+	s.Lock()
+	defer s.Unlock()
+
+	return s.err
+}
+
+// Close stops the stream and returns its client to the pool.
+func (s *AttributeStream) Close() {
+	s.Lock()
+	defer s.Unlock()
+
+	s.values = nil
+	s.release()
+}
+
+func (s *AttributeStream) release() {
+	if s.cursor == nil {
+		return
+	}
+
+	DeleteAttributeCursor(s.cursor)
+	s.cursor = nil
+
+	s.conn.pool.put(s.pc, s.err)
+	s.pc = nil
+}
@@ -0,0 +1,121 @@
+package ldapcpp
+
+import "errors"
+
+var errResultSetCorrupted = NewError(ErrorUnexpectedResponse, errors.New("search result set is corrupted"))
+
+// newEntries converts the result set to entries, keeping the server order.
+// The set is written with a single call into a Go buffer, that backs DNs and values
+// of the entries, so its data is copied once, see searchResultSet::serialize.
+// Attribute names are interned in names.
+func newEntries(set SearchResultSet, names *attributeNames) ([]*Entry, error) {
+	buf := make([]byte, int(set.SerializedSize()))
+	set.Serialize(buf)
+	return decodeEntries(unsafeString(buf), names)
+}
+
+// resultSetDecoder reads searchResultSet::serialize buffer. Returned strings
+// are substrings of the buffer, so values are not copied again.
+type resultSetDecoder struct {
+	buf   string
+	pos   int
+	arena string
+	err   error
+}
+
+func (d *resultSetDecoder) uint32() int {
+	if d.err != nil {
+		return 0
+	}
+	if len(d.buf)-d.pos < 4 {
+		d.err = errResultSetCorrupted
+		return 0
+	}
+	b := d.buf[d.pos : d.pos+4]
+	d.pos += 4
+	return int(uint32(b[0]) | uint32(b[1])<<8 | uint32(b[2])<<16 | uint32(b[3])<<24)
+}
+
+// span reads offset and length, and returns that part of the arena
+func (d *resultSetDecoder) span() string {
+	offset, length := d.uint32(), d.uint32()
+	if d.err != nil {
+		return ""
+	}
+	if offset > len(d.arena) || length > len(d.arena)-offset {
+		d.err = errResultSetCorrupted
+		return ""
+	}
+	return d.arena[offset : offset+length]
+}
+
+// decodeEntries decodes the serialized result set without copying, DNs and values
+// are substrings of buf and keep it alive.
+func decodeEntries(buf string, names *attributeNames) ([]*Entry, error) {
+	d := &resultSetDecoder{buf: buf}
+
+	entryCount, nameCount, attrCount, valueCount, arenaSize := d.uint32(), d.uint32(), d.uint32(), d.uint32(), d.uint32()
+	tablesSize := 4 * (3*entryCount + 3*nameCount + 2*attrCount + 2*valueCount)
+	if d.err != nil || len(buf)-d.pos != tablesSize+arenaSize {
+		return nil, errResultSetCorrupted
+	}
+	d.arena = buf[d.pos+tablesSize:]
+
+	// tables are laid out one after another, so they are read with separate decoders
+	nameTable := &resultSetDecoder{buf: buf, pos: d.pos + 4*3*entryCount, arena: d.arena}
+	attrs := &resultSetDecoder{buf: buf, pos: nameTable.pos + 4*3*nameCount, arena: d.arena}
+	values := &resultSetDecoder{buf: buf, pos: attrs.pos + 4*2*attrCount, arena: d.arena}
+
+	attrNames := make([]attributeName, nameCount)
+	for i := range attrNames {
+		name, id := nameTable.span(), nameTable.uint32()
+		if nameTable.err != nil {
+			return nil, errResultSetCorrupted
+		}
+		attrNames[i] = names.intern(name, id)
+	}
+
+	// values and their byte views of all attributes share two allocations
+	allValues := make([]string, valueCount)
+	allBytes := make([][]byte, valueCount)
+	next := 0
+
+	entries := make([]*Entry, entryCount)
+	for i := range entries {
+		dn := d.span()
+		n := d.uint32()
+		if n > attrCount {
+			return nil, errResultSetCorrupted
+		}
+		entryAttrs := make([]*EntryAttribute, n)
+		for j := range entryAttrs {
+			nameIndex, m := attrs.uint32(), attrs.uint32()
+			if nameIndex >= nameCount || m > valueCount-next {
+				return nil, errResultSetCorrupted
+			}
+			entryValues := allValues[next : next+m : next+m]
+			entryBytes := allBytes[next : next+m : next+m]
+			next += m
+			for k := range entryValues {
+				entryValues[k] = values.span()
+				entryBytes[k] = unsafeBytes(entryValues[k])
+			}
+			entryAttrs[j] = &EntryAttribute{
+				Name:       attrNames[nameIndex].name,
+				Values:     entryValues,
+				ByteValues: entryBytes,
+				id:         attrNames[nameIndex].id,
+			}
+		}
+		if d.err != nil || attrs.err != nil || values.err != nil {
+			return nil, errResultSetCorrupted
+		}
+		entries[i] = &Entry{
+			DN:         dn,
+			Attributes: entryAttrs,
+			index:      newAttributeIndex(names, entryAttrs),
+		}
+	}
+
+	return entries, nil
+}
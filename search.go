@@ -6,6 +6,7 @@ import "C"
 import (
 	"fmt"
 	"strings"
+	"sync"
 )
 
 // scope choices
@@ -15,50 +16,231 @@ const (
 	ScopeWholeSubtree = C.LDAP_SCOPE_SUBTREE
 )
 
-// Search performs the given search request
-func (conn *Conn) Search(req *SearchRequest) (res *SearchResult, err error) {
-	conn.Lock()
-	defer conn.Unlock()
+// page size choices
+const (
+	// PageSizeDefault uses the page size of the connection
+	PageSizeDefault = 0
+	// PageSizeAdaptive grows the page size from the observed entry sizes
+	PageSizeAdaptive = -1
+)
 
-	defer Recover(&err)
+// Search performs the given search request.
+// DNs and values of all returned entries share one buffer, the size of the whole
+// result, and keeping any of them keeps it all. Use SearchStream for large results.
+func (conn *Conn) Search(req *SearchRequest) (*SearchResult, error) {
+	var entries []*Entry
+	var targetPosition, contentCount int
+	var decodeErr error
+
+	err := conn.lease(func(client Client) {
+		cAttrs := slice2vector(req.attributes())
+		defer DeleteStringVector(cAttrs)
+
+		sparams := req.searchParams()
+		defer DeleteClientSearchParams(sparams)
+
+		set := client.SearchResults(req.BaseDN, req.Filter, req.Scope, cAttrs, sparams)
+		defer DeleteSearchResultSet(set)
+
+		entries, decodeErr = newEntries(set, conn.names)
+		targetPosition = int(set.VlvTargetPosition())
+		contentCount = int(set.VlvContentCount())
+	})
+	if err == nil {
+		err = decodeErr
+	}
+	if err != nil {
+		return nil, err
+	}
+	return &SearchResult{
+		Entries:        entries,
+		TargetPosition: targetPosition,
+		ContentCount:   contentCount,
+	}, nil
+}
 
-	vector := conn.client.SearchDN(req.BaseDN, req.Filter, req.Scope)
-	defer DeleteStringVector(vector)
-	dns := vector2slice(vector)
+// SearchAsync sends the given search request without waiting for the response.
+// Many requests could be in flight over the same connection. The request is not
+// paged, so it suits lookups with small results (e.g. ScopeBaseObject).
+func (conn *Conn) SearchAsync(req *SearchRequest) *SearchFuture {
+	f := &SearchFuture{Future: *newFuture()}
+
+	pc, msgid, err := conn.submit(func(client Client) int {
+		cAttrs := slice2vector(req.attributes())
+		defer DeleteStringVector(cAttrs)
+
+		return client.AsyncSearch(req.BaseDN, req.Filter, req.Scope, cAttrs)
+	})
+	if err != nil {
+		f.err = err
+		close(f.done)
+		return f
+	}
+
+	go func() {
+		defer close(f.done)
 
-	cAttrs := NewStringVector()
+		result, err := conn.wait(pc, msgid)
+		if err != nil {
+			f.err = err
+			return
+		}
+		defer DeleteAsyncResult(result)
+
+		entries, err := newEntries(result.GetEntries(), conn.names)
+		if err != nil {
+			f.err = err
+			return
+		}
+		f.res = &SearchResult{
+			Entries: entries,
+		}
+	}()
+
+	return f
+}
+
+// SearchStream performs the given search request and returns a stream, that fetches
+// the entries page by page, as they are consumed. Only the current page is kept in memory.
+// The stream has its own newly bound client, that is closed when the stream is exhausted
+// or closed, so other operations of the connection are not held up between pages.
+// A page stays in memory while any DN or value of its entries is referenced, see Entry.
+func (conn *Conn) SearchStream(req *SearchRequest) (stream *SearchStream, err error) {
+	client, err := conn.pool.dedicated()
+	if err != nil {
+		return nil, err
+	}
+	defer func() {
+		if err != nil {
+			DeleteClient(client)
+		}
+	}()
+	defer Recover(&err)
+
+	cAttrs := slice2vector(req.attributes())
 	defer DeleteStringVector(cAttrs)
 
-	if len(req.Attributes) == 0 {
-		cAttrs.Add("*")
-	} else {
-		for _, attr := range req.Attributes {
-			cAttrs.Add(attr)
+	sparams := req.searchParams()
+	defer DeleteClientSearchParams(sparams)
+
+	return &SearchStream{
+		conn:   conn,
+		client: client,
+		cursor: client.OpenSearch(req.BaseDN, req.Filter, req.Scope, cAttrs, sparams),
+		done:   make(chan struct{}),
+	}, nil
+}
+
+// SearchStream iterates over the entries of a search request.
+//
+//	stream, err := conn.SearchStream(req)
+//	if err != nil {
+//		return err
+//	}
+//	defer stream.Close()
+//
+//	for stream.Next() {
+//		entry := stream.Entry()
+//		...
+//	}
+//	return stream.Err()
+type SearchStream struct {
+	sync.Mutex
+
+	conn    *Conn
+	client  Client
+	cursor  SearchCursor
+	entries []*Entry
+	entry   *Entry
+	err     error
+
+	done      chan struct{}
+	closeOnce sync.Once
+}
+
+// Next advances the stream to the next entry, fetching the next page when the
+// current one is consumed. It returns false when there are no more entries or on error.
+func (s *SearchStream) Next() bool {
+	s.Lock()
+	defer s.Unlock()
+
+	s.entry = nil
+	for len(s.entries) == 0 {
+		if s.cursor == nil || s.err != nil {
+			return false
+		}
+		if !s.fetch() {
+			s.release()
+			return false
 		}
 	}
 
-	res = &SearchResult{}
+	s.entry, s.entries = s.entries[0], s.entries[1:]
+	return true
+}
 
-	for _, dn := range dns {
-		cmap := conn.client.GetObjectAttributes(dn, cAttrs)
-		defer DeleteString_VectorString_Map(cmap)
+func (s *SearchStream) fetch() (more bool) {
+	defer Recover(&s.err)
 
-		var attrs []*EntryAttribute
+	if !s.cursor.Next() {
+		return false
+	}
+	s.entries, s.err = newEntries(s.cursor.Page(), s.conn.names)
+	return s.err == nil
+}
+
+// Entry returns the current entry
+func (s *SearchStream) Entry() *Entry {
+	return s.entry
+}
 
-		keys := cmap.Keys()
-		for i := 0; i < int(keys.Size()); i++ {
-			name := keys.Get(i)
-			values := cmap.Get(name)
+// Err returns the error, that stopped the stream, if any
+func (s *SearchStream) Err() error {
+	s.Lock()
+	defer s.Unlock()
 
-			attr := NewEntryAttribute(name, vector2slice(values))
-			attrs = append(attrs, attr)
+	return s.err
+}
+
+// Chan returns a channel, that receives the entries of the stream. The next page is
+// fetched only when the receiver has consumed the current one. The channel is closed
+// when the stream is exhausted, failed (see Err) or closed.
+func (s *SearchStream) Chan() <-chan *Entry {
+	ch := make(chan *Entry)
+	go func() {
+		defer close(ch)
+		for s.Next() {
+			select {
+			case ch <- s.Entry():
+			case <-s.done:
+				return
+			}
 		}
+	}()
+	return ch
+}
+
+// Close stops the stream and releases the server-side paged search state.
+func (s *SearchStream) Close() {
+	s.closeOnce.Do(func() { close(s.done) })
+
+	s.Lock()
+	defer s.Unlock()
 
-		entry := NewEntry(dn, attrs)
-		res.Entries = append(res.Entries, entry)
+	s.entries = nil
+	s.release()
+}
+
+func (s *SearchStream) release() {
+	if s.cursor == nil {
+		return
 	}
 
-	return res, nil
+	DeleteSearchCursor(s.cursor)
+	s.cursor = nil
+
+	DeleteClient(s.client)
+	s.client = nil
 }
 
 func NewEntry(dn string, attrs []*EntryAttribute) *Entry {
@@ -68,51 +250,69 @@ func NewEntry(dn string, attrs []*EntryAttribute) *Entry {
 	}
 }
 
-// Entry represents a single search result entry
+// Entry represents a single search result entry.
+// DNs and values of entries returned by search are substrings of the buffer they were
+// received in, so keeping any of them keeps the whole buffer in memory: the whole result
+// of Search and SearchAsync, a single page (up to the page memory budget) of SearchStream.
+// Values kept long after the search should be copied, e.g. string([]byte(value)).
 type Entry struct {
 	// DN is the distinguished name of the entry
 	DN string
 	// Attributes are the returned attributes for the entry
 	Attributes []*EntryAttribute
+
+	// index of attributes by interned name, for entries returned by search
+	index *attributeIndex
 }
 
-// GetAttributeValues returns the values for the named attribute, or an empty list
-func (e *Entry) GetAttributeValues(attribute string) []string {
+// attribute returns the attribute matching name, ignoring case if equalFold is set
+func (e *Entry) attribute(name string, equalFold bool) *EntryAttribute {
+	if e.index != nil && e.index.size == len(e.Attributes) {
+		attr := e.index.find(e.Attributes, name)
+		if attr != nil && (equalFold || attr.Name == name) {
+			return attr
+		}
+		// the index is stale if Attributes were reordered or replaced, it is checked below
+	}
+
 	for _, attr := range e.Attributes {
-		if attr.Name == attribute {
-			return attr.Values
+		if attr.Name == name || (equalFold && strings.EqualFold(attr.Name, name)) {
+			return attr
 		}
 	}
+	return nil
+}
+
+// GetAttributeValues returns the values for the named attribute, or an empty list
+func (e *Entry) GetAttributeValues(attribute string) []string {
+	if attr := e.attribute(attribute, false); attr != nil {
+		return attr.Values
+	}
 	return []string{}
 }
 
 // GetEqualFoldAttributeValues returns the values for the named attribute, or an
-// empty list. Attribute matching is done with strings.EqualFold.
+// empty list. Attribute matching is case-insensitive, like strings.EqualFold.
 func (e *Entry) GetEqualFoldAttributeValues(attribute string) []string {
-	for _, attr := range e.Attributes {
-		if strings.EqualFold(attribute, attr.Name) {
-			return attr.Values
-		}
+	if attr := e.attribute(attribute, true); attr != nil {
+		return attr.Values
 	}
 	return []string{}
 }
 
-// GetRawAttributeValues returns the byte values for the named attribute, or an empty list
+// GetRawAttributeValues returns the byte values for the named attribute, or an empty list.
+// Values of entries returned by search are read-only, see EntryAttribute.ByteValues.
 func (e *Entry) GetRawAttributeValues(attribute string) [][]byte {
-	for _, attr := range e.Attributes {
-		if attr.Name == attribute {
-			return attr.ByteValues
-		}
+	if attr := e.attribute(attribute, false); attr != nil {
+		return attr.RawValues()
 	}
 	return [][]byte{}
 }
 
 // GetEqualFoldRawAttributeValues returns the byte values for the named attribute, or an empty list
 func (e *Entry) GetEqualFoldRawAttributeValues(attribute string) [][]byte {
-	for _, attr := range e.Attributes {
-		if strings.EqualFold(attr.Name, attribute) {
-			return attr.ByteValues
-		}
+	if attr := e.attribute(attribute, true); attr != nil {
+		return attr.RawValues()
 	}
 	return [][]byte{}
 }
@@ -172,14 +372,9 @@ func (e *Entry) PrettyPrint(indent int) {
 
 // NewEntryAttribute returns a new EntryAttribute with the desired key-value pair
 func NewEntryAttribute(name string, values []string) *EntryAttribute {
-	var bytes [][]byte
-	for _, value := range values {
-		bytes = append(bytes, []byte(value))
-	}
 	return &EntryAttribute{
-		Name:       name,
-		Values:     values,
-		ByteValues: bytes,
+		Name:   name,
+		Values: values,
 	}
 }
 
@@ -189,8 +384,51 @@ type EntryAttribute struct {
 	Name string
 	// Values contain the string values of the attribute
 	Values []string
-	// ByteValues contain the raw values of the attribute
+	// ByteValues contain the raw values of the attribute. Attributes returned by search
+	// keep values once: ByteValues share memory with the immutable strings of Values,
+	// so they must not be modified. Copy them before changing them.
 	ByteValues [][]byte
+
+	// interned name id, for attributes returned by search
+	id int
+}
+
+// RawValues returns the raw values of the attribute: ByteValues if they are set
+// (read-only for attributes returned by search), otherwise new copies of Values.
+func (e *EntryAttribute) RawValues() [][]byte {
+	if e.ByteValues != nil {
+		return e.ByteValues
+	}
+	return copyBytes(e.Values)
+}
+
+func copyBytes(values []string) [][]byte {
+	if values == nil {
+		return nil
+	}
+	raw := make([][]byte, len(values))
+	for i, value := range values {
+		raw[i] = []byte(value)
+	}
+	return raw
+}
+
+// UnsafeRawValues returns the raw values of the attribute without copying them, ByteValues
+// if they are set. The returned bytes share memory with the immutable strings of Values,
+// they must not be modified: doing so corrupts Values or crashes the program.
+func (e *EntryAttribute) UnsafeRawValues() [][]byte {
+	if e.ByteValues != nil {
+		return e.ByteValues
+	}
+	if e.Values == nil {
+		return nil
+	}
+
+	raw := make([][]byte, len(e.Values))
+	for i, value := range e.Values {
+		raw[i] = unsafeBytes(value)
+	}
+	return raw
 }
 
 // Print outputs a human-readable description
@@ -207,6 +445,10 @@ func (e *EntryAttribute) PrettyPrint(indent int) {
 type SearchResult struct {
 	// Entries are the returned entries
 	Entries []*Entry
+	// TargetPosition is the position of the target entry of VLV window, and ContentCount
+	// is the server's estimate of the number of sorted entries. They are 0 without VLV.
+	TargetPosition int
+	ContentCount   int
 }
 
 // Print outputs a human-readable description
@@ -229,6 +471,53 @@ type SearchRequest struct {
 	Scope      int
 	Filter     string
 	Attributes []string
+	// PageSize overrides the page size of the connection, see PageSizeDefault and PageSizeAdaptive
+	PageSize int
+	// SortBy sorts entries on the server (RFC 2891), e.g. "sn -whenCreated" ('-' for reverse order)
+	SortBy string
+	// VLV returns a window of sorted entries instead of all of them, it needs SortBy
+	VLV *VLVWindow
+}
+
+// VLVWindow is a virtual list view window: Before entries before and After entries
+// after the target entry at Offset (1-based) of ContentCount sorted entries. Use 0 for
+// ContentCount on the first request, then the ContentCount of the previous result.
+type VLVWindow struct {
+	Offset       int
+	Before       int
+	After        int
+	ContentCount int
+}
+
+// NewVLVWindow returns the window of a page of pageSize entries, the first page is 1
+func NewVLVWindow(page, pageSize, contentCount int) *VLVWindow {
+	return &VLVWindow{
+		Offset:       (page-1)*pageSize + 1,
+		After:        pageSize - 1,
+		ContentCount: contentCount,
+	}
+}
+
+// attributes returns requested attributes, all user attributes if none are given
+func (req *SearchRequest) attributes() []string {
+	if len(req.Attributes) == 0 {
+		return []string{"*"}
+	}
+	return req.Attributes
+}
+
+// searchParams returns new ClientSearchParams, that must be deleted by the caller
+func (req *SearchRequest) searchParams() ClientSearchParams {
+	sparams := NewClientSearchParams()
+	sparams.SetPagesize(req.PageSize)
+	sparams.SetSort(req.SortBy)
+	if req.VLV != nil {
+		sparams.SetVlv_offset(req.VLV.Offset)
+		sparams.SetVlv_before(req.VLV.Before)
+		sparams.SetVlv_after(req.VLV.After)
+		sparams.SetVlv_content_count(req.VLV.ContentCount)
+	}
+	return sparams
 }
 
 // NewSearchRequest creates a new search request
@@ -0,0 +1,423 @@
+#include <ldap.h>
+#include <poll.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "client.h"
+
+/*
+  Asynchronous operations.
+
+  Requests are sent with non-blocking ldap_*_ext calls and tracked by msgid,
+  so many requests could be in flight over one bound connection.
+  Completions are collected by dispatcher thread, that is started with the first
+  async request and stopped on rebind or client destruction.
+
+  Dispatcher asks ldap_result only for its own msgids, responses to other
+  (synchronous) requests are left queued in LDAP handle for their callers.
+  Between rounds it polls the socket, unless libldap has buffered data already.
+  It relies on thread safe libldap (OpenLDAP >= 2.5, or libldap_r).
+
+  Futures of results are kept by client, apart from the dispatcher state, so
+  requests failed by rebind (LDAP_SERVER_DOWN) could be claimed after it.
+*/
+
+struct asyncOperation {
+    int type;
+    // changed entry, its cached lookups are dropped again on completion
+    string dn;
+    // new RDN and parent of renamed entry, lookups of the new DN are dropped on completion
+    string newrdn;
+    string newparent;
+    std::promise<asyncResult> promise;
+};
+
+struct asyncState {
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // requests, that are waiting for a response
+    std::map <int, asyncOperation *> pending;
+
+    std::thread dispatcher;
+    bool stop;
+
+    asyncState() : stop(false) {}
+};
+
+int client::asyncRegister(int msgid, int type, string dn, string newrdn, string newparent) {
+/*
+  It starts tracking of sent request, and starts dispatcher if it is not running.
+  Cached lookups of changed dn (if any) are dropped, so they are not served while request is in flight.
+*/
+    if (!dn.empty()) {
+        invalidate(dn, type == LDAP_RES_MODDN);
+    }
+
+    asyncOperation *op = new asyncOperation();
+    op->type = type;
+    op->dn = dn;
+    op->newrdn = newrdn;
+    op->newparent = newparent;
+
+    std::shared_ptr <asyncState> state;
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        if (!async) {
+            async = std::make_shared<asyncState>();
+        }
+        state = async;
+        // unclaimed result of a lost session with the same msgid is dropped
+        async_futures[msgid] = op->promise.get_future().share();
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    state->pending[msgid] = op;
+
+    if (!state->dispatcher.joinable()) {
+        state->dispatcher = std::thread(&client::asyncDispatch, this, state);
+    }
+    state->cv.notify_one();
+
+    return msgid;
+}
+
+void client::asyncDispatch(std::shared_ptr <asyncState> state) {
+/*
+  Dispatcher thread loop.
+*/
+    std::unique_lock<std::mutex> lock(state->mutex);
+    // the previous loop has not polled, as data was buffered already
+    bool buffered = false;
+
+    while (!state->stop) {
+        if (state->pending.empty()) {
+            state->cv.wait(lock);
+            continue;
+        }
+
+        vector <int> msgids;
+        for (std::map <int, asyncOperation *>::iterator it = state->pending.begin(); it != state->pending.end(); ++it) {
+            msgids.push_back(it->first);
+        }
+        lock.unlock();
+
+        int completed = 0;
+        for (size_t i = 0; i < msgids.size(); ++i) {
+            struct timeval zero = {0, 0};
+            LDAPMessage *res = NULL;
+
+            int rc = ldap_result(ds, msgids[i], LDAP_MSG_ALL, &zero, &res);
+            if (rc == 0) continue;
+
+            asyncComplete(*state, msgids[i], rc, res);
+            ldap_msgfree(res);
+            completed++;
+        }
+
+        if (completed == 0) {
+            // nothing is complete yet, wait for more data from server.
+            // Data read ahead by libldap or TLS (by a synchronous caller too) does not wake poll,
+            // it is read right away, unless it was buffered in the last loop too (a partial response).
+            Sockbuf *sb = NULL;
+            bool ready = !buffered && ldap_get_option(ds, LDAP_OPT_SOCKBUF, &sb) == LDAP_OPT_SUCCESS &&
+                sb != NULL && ber_sockbuf_ctrl(sb, LBER_SB_OPT_DATA_READY, NULL) > 0;
+            buffered = ready;
+
+            int fd = -1;
+            if (ready) {
+                lock.lock();
+                continue;
+            }
+            if (ldap_get_option(ds, LDAP_OPT_DESC, &fd) == LDAP_OPT_SUCCESS && fd >= 0) {
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                poll(&pfd, 1, ASYNC_POLL_TIMEOUT_MS);
+            } else {
+                usleep(ASYNC_POLL_TIMEOUT_MS * 1000);
+            }
+        } else {
+            buffered = false;
+        }
+
+        lock.lock();
+    }
+}
+
+void client::asyncComplete(asyncState &state, int msgid, int rc, LDAPMessage *res) {
+/*
+  It converts response to asyncResult and hands it over to waiters.
+*/
+    asyncResult result;
+    result.msgid = msgid;
+    result.entries = searchResultSet(names);
+
+    if (rc == -1) {
+        ldap_get_option(ds, LDAP_OPT_RESULT_CODE, &result.code);
+        result.error_msg = "Error in async ldap_result: ";
+        result.error_msg.append(ldap_err2string(result.code));
+    } else {
+        for (LDAPMessage *msg = ldap_first_message(ds, res); msg != NULL; msg = ldap_next_message(ds, msg)) {
+            int type = ldap_msgtype(msg);
+            if (type == LDAP_RES_SEARCH_ENTRY) {
+                try {
+                    _appendentry(msg, result.entries);
+                } catch (SearchException &ex) {
+                    result.code = ex.code;
+                    result.error_msg = ex.msg;
+                }
+            } else if (type != LDAP_RES_SEARCH_REFERENCE && type != LDAP_RES_INTERMEDIATE) {
+                int errcode;
+                char *errmsg = NULL;
+                int parse_rc = ldap_parse_result(ds, msg, &errcode, NULL, &errmsg, NULL, NULL, 0);
+                if (parse_rc != LDAP_SUCCESS) {
+                    result.code = parse_rc;
+                    result.error_msg = "Failed to parse async result: ";
+                    result.error_msg.append(ldap_err2string(parse_rc));
+                } else if (errcode != LDAP_SUCCESS) {
+                    result.code = errcode;
+                    result.error_msg = "Error in async operation: ";
+                    result.error_msg.append(ldap_err2string(errcode));
+                    if (errmsg != NULL && *errmsg) {
+                        result.error_msg.append(" (" + string(errmsg) + ")");
+                    }
+                }
+                ldap_memfree(errmsg);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    std::map <int, asyncOperation *>::iterator it = state.pending.find(msgid);
+    if (it == state.pending.end()) {
+        // abandoned
+        return;
+    }
+    asyncOperation *op = it->second;
+    state.pending.erase(it);
+
+    // lookups cached while request was in flight could hold old values,
+    // and the new DN of renamed entry could have been looked up and found missing
+    if (op->type == LDAP_RES_MODDN) {
+        invalidateRenamed(op->dn, op->newrdn, op->newparent);
+    } else if (!op->dn.empty()) {
+        invalidate(op->dn, false);
+    }
+
+    if (result.code == LDAP_SUCCESS) {
+        op->promise.set_value(result);
+    } else if (op->type == LDAP_RES_SEARCH_RESULT) {
+        op->promise.set_exception(std::make_exception_ptr(SearchException(result.error_msg, result.code)));
+    } else {
+        op->promise.set_exception(std::make_exception_ptr(OperationalException(result.error_msg, result.code)));
+    }
+    delete op;
+}
+
+void client::asyncShutdown() {
+/*
+  It stops dispatcher and fails all requests in flight, before LDAP handle is closed.
+  Their futures stay with client, so waiters get LDAP_SERVER_DOWN.
+*/
+    std::shared_ptr <asyncState> state;
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        state.swap(async);
+    }
+    if (!state) return;
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->stop = true;
+        state->cv.notify_one();
+    }
+    if (state->dispatcher.joinable()) {
+        state->dispatcher.join();
+    }
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (std::map <int, asyncOperation *>::iterator it = state->pending.begin(); it != state->pending.end(); ++it) {
+        string error_msg = "Connection closed with async operation in flight";
+        if (it->second->type == LDAP_RES_SEARCH_RESULT) {
+            it->second->promise.set_exception(std::make_exception_ptr(SearchException(error_msg, LDAP_SERVER_DOWN)));
+        } else {
+            it->second->promise.set_exception(std::make_exception_ptr(OperationalException(error_msg, LDAP_SERVER_DOWN)));
+        }
+        delete it->second;
+    }
+    state->pending.clear();
+}
+
+int client::asyncSearch(string search_base, string filter, int scope, const vector <string> &attributes) {
+/*
+  It sends search request (without paging) and returns its msgid.
+  Result is available with asyncWait/asyncFuture.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    vector <char *> attrs;
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        attrs.push_back(strdup(attributes[i].c_str()));
+    }
+    attrs.push_back(NULL);
+
+    replace(filter, "\\", "\\\\");
+
+    int msgid;
+    int result = ldap_search_ext(ds, search_base.c_str(), scope, filter.c_str(), &attrs[0], 0, NULL, NULL, NULL, LDAP_NO_LIMIT, &msgid);
+
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        free(attrs[i]);
+    }
+
+    if (result != LDAP_SUCCESS) {
+        string error_msg = "Error in ldap_search_ext: ";
+        error_msg.append(ldap_err2string(result));
+        throw SearchException(error_msg, result);
+    }
+
+    return asyncRegister(msgid, LDAP_RES_SEARCH_RESULT, "");
+}
+
+int client::asyncModify(string dn, int mod_op, string attribute, vector <string> list) {
+/*
+  It sends modify request and returns its msgid.
+*/
+    std::vector <clientModification> mods;
+    mods.push_back(clientModification(mod_op, attribute, list));
+
+    return asyncModify(dn, mods);
+}
+
+int client::asyncModify(string dn, const std::vector <clientModification> &mods) {
+/*
+  It sends all modifications of an object in a single modify request and returns its msgid.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+    if (mods.empty()) throw OperationalException("Empty modify '" + dn + "'", PARAMS_ERROR);
+
+    LDAPModList attrs(mods);
+
+    // request is encoded right away, so values are not referenced after the call
+    int msgid;
+    int result = ldap_modify_ext(ds, dn.c_str(), attrs.get(), NULL, NULL, &msgid);
+    if (result != LDAP_SUCCESS) {
+        string error_msg = "Error in modify '" + dn + "', ldap_modify_ext: ";
+        error_msg.append(ldap_err2string(result));
+        throw OperationalException(error_msg, result);
+    }
+
+    return asyncRegister(msgid, LDAP_RES_MODIFY, dn);
+}
+
+int client::asyncModifyDN(string dn, string newrdn, string newparent, int deleteoldrdn) {
+/*
+  It sends modify DN request and returns its msgid.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    int msgid;
+    int result = ldap_rename(ds, dn.c_str(), newrdn.c_str(), newparent.c_str(), deleteoldrdn, NULL, NULL, &msgid);
+    if (result != LDAP_SUCCESS) {
+        string error_msg = "Error in modifyDN, ldap_rename: ";
+        error_msg.append(ldap_err2string(result));
+        throw OperationalException(error_msg, result);
+    }
+
+    return asyncRegister(msgid, LDAP_RES_MODDN, dn, newrdn, newparent);
+}
+
+int client::asyncDeleteDN(string dn) {
+/*
+  It sends delete request and returns its msgid.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    int msgid;
+    int result = ldap_delete_ext(ds, dn.c_str(), NULL, NULL, &msgid);
+    if (result != LDAP_SUCCESS) {
+        string error_msg = "Error in DeleteDN, ldap_delete_ext: ";
+        error_msg.append(ldap_err2string(result));
+        throw OperationalException(error_msg, result);
+    }
+
+    return asyncRegister(msgid, LDAP_RES_DELETE, dn);
+}
+
+std::shared_future<asyncResult> client::asyncFuture(int msgid) {
+/*
+  It returns future of async request result, and releases result from client.
+  Each result could be claimed only once, either with asyncFuture or asyncWait.
+  Future throws SearchException/OperationalException if request has failed.
+*/
+    std::lock_guard<std::mutex> lock(async_mutex);
+
+    std::map <int, std::shared_future<asyncResult> >::iterator it = async_futures.find(msgid);
+    if (it == async_futures.end()) {
+        throw OperationalException("Unknown async operation " + itos(msgid), PARAMS_ERROR);
+    }
+    std::shared_future<asyncResult> future = it->second;
+    async_futures.erase(it);
+
+    return future;
+}
+
+asyncResult client::asyncWait(int msgid) {
+/*
+  It blocks until async request is complete and returns its result.
+  It throws SearchException/OperationalException if request has failed.
+  Waiters do not own the client, so ranged attributes are left as received.
+*/
+    return asyncFuture(msgid).get();
+}
+
+void client::asyncResolve(asyncResult &result) {
+/*
+  It fetches remaining ranges of ranged attributes of async search result.
+  Ranges are fetched with synchronous searches, that could reconnect, so it is
+  called by the owner of the client, neither by dispatcher nor by waiters.
+*/
+    _resolveranges(result.entries, 0);
+}
+
+bool client::asyncReady(int msgid) {
+/*
+  It returns true if async request is complete, so asyncWait would not block.
+*/
+    std::lock_guard<std::mutex> lock(async_mutex);
+
+    std::map <int, std::shared_future<asyncResult> >::iterator it = async_futures.find(msgid);
+    if (it == async_futures.end()) {
+        return false;
+    }
+    return it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void client::asyncAbandon(int msgid) {
+/*
+  It abandons async request and forgets its result.
+*/
+    std::shared_ptr <asyncState> state;
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        async_futures.erase(msgid);
+        state = async;
+    }
+    if (!state) return;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    std::map <int, asyncOperation *>::iterator it = state->pending.find(msgid);
+    if (it != state->pending.end()) {
+        delete it->second;
+        state->pending.erase(it);
+        if (ds != NULL) {
+            ldap_abandon_ext(ds, msgid, NULL, NULL);
+        }
+    }
+}
@@ -0,0 +1,577 @@
+#include <list>
+#include <atomic>
+
+#include "client.h"
+
+/*
+  Client-side caches of base lookups.
+
+  Lookups are spread over shards by hash of normalized DN, so all lookups of a DN
+  live in one shard and could be invalidated together. Each shard has its own lock,
+  LRU list and share of the memory budget.
+  Invalidation bumps generation of the shard: a lookup, that was sent before it, could
+  hold values from before the change, so it is not stored (see generation()).
+  Each shard also maps objectGUID of its cached DNs to the DN, so changes reported under
+  another DN (renames, moves, deletes seen as tombstones) find the cached one (see findGUID()).
+  Failed lookups are kept in a separate small cache, with a single lock. It has
+  generations of DNs by the same hash, so lookups sent before a rename, that has
+  created the DN, are not stored as missing either.
+*/
+
+struct cachedLookup {
+    string dn;
+    string selector;
+    map <string, vector<string> > attrs;
+    size_t bytes;
+    time_t expires;
+};
+
+struct entryCacheShard {
+    std::mutex mutex;
+    // the most recently used first
+    std::list <cachedLookup> lru;
+    // normalized DN -> selector -> lookup
+    std::unordered_map <string, std::unordered_map <string, std::list<cachedLookup>::iterator> > index;
+    // objectGUID -> normalized DN, and back, of DNs with cached lookups
+    std::unordered_map <string, string> guids;
+    std::unordered_map <string, string> dn_guids;
+    size_t bytes;
+    // bumped on every invalidation of a DN of the shard
+    uint64_t generation;
+
+    entryCacheShard() : bytes(0), generation(0) {}
+
+    void erase(std::list<cachedLookup>::iterator it) {
+        std::unordered_map <string, std::unordered_map <string, std::list<cachedLookup>::iterator> >::iterator dn_it = index.find(it->dn);
+        if (dn_it != index.end()) {
+            dn_it->second.erase(it->selector);
+            if (dn_it->second.empty()) {
+                index.erase(dn_it);
+                forget(it->dn);
+            }
+        }
+        bytes -= it->bytes;
+        lru.erase(it);
+    }
+
+    void remember(const string &dn, const string &guid) {
+        forget(dn);
+        std::unordered_map <string, string>::iterator it = guids.find(guid);
+        if (it != guids.end()) dn_guids.erase(it->second);
+        guids[guid] = dn;
+        dn_guids[dn] = guid;
+    }
+
+    void forget(const string &dn) {
+        std::unordered_map <string, string>::iterator it = dn_guids.find(dn);
+        if (it == dn_guids.end()) return;
+        guids.erase(it->second);
+        dn_guids.erase(it);
+    }
+};
+
+struct entryCache::state {
+    entryCacheShard shards[ENTRY_CACHE_SHARDS];
+    size_t max_shard_bytes;
+    int ttl;
+
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+    std::atomic<long> evictions;
+
+    state() : max_shard_bytes(0), ttl(0), hits(0), misses(0), evictions(0) {}
+
+    entryCacheShard &shard(const string &dn) {
+        return shards[std::hash<string>()(dn) % ENTRY_CACHE_SHARDS];
+    }
+};
+
+// rough per-string overhead of std::string and container nodes
+static const size_t cache_overhead = 64;
+
+entryCache::entryCache(long max_bytes, int ttl) :
+    shared(std::make_shared<state>()) {
+    shared->max_shard_bytes = std::max(max_bytes, 0L) / ENTRY_CACHE_SHARDS;
+    shared->ttl = ttl;
+}
+
+long entryCache::hits() { return shared->hits; }
+long entryCache::misses() { return shared->misses; }
+long entryCache::evictions() { return shared->evictions; }
+
+long entryCache::size() {
+    long count = 0;
+    for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) {
+        std::lock_guard<std::mutex> lock(shared->shards[i].mutex);
+        count += shared->shards[i].lru.size();
+    }
+    return count;
+}
+
+long entryCache::bytes() {
+    long total = 0;
+    for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) {
+        std::lock_guard<std::mutex> lock(shared->shards[i].mutex);
+        total += shared->shards[i].bytes;
+    }
+    return total;
+}
+
+void entryCache::clear() {
+    for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) {
+        entryCacheShard &shard = shared->shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.guids.clear();
+        shard.dn_guids.clear();
+        shard.bytes = 0;
+        shard.generation++;
+    }
+}
+
+string entryCache::normalize(const string &dn) {
+/*
+  It returns dn in lower case, with spaces around unescaped ',', '=' and '+' removed.
+*/
+    string result;
+    result.reserve(dn.size());
+
+    bool escaped = false;
+    for (size_t i = 0; i < dn.size(); ++i) {
+        char c = dn[i];
+        if (escaped) {
+            result += tolower(c);
+            escaped = false;
+            continue;
+        }
+        if (c == '\\') {
+            escaped = true;
+        } else if (c == ',' || c == '=' || c == '+') {
+            while (!result.empty() && result[result.size() - 1] == ' ' &&
+                   (result.size() < 2 || result[result.size() - 2] != '\\')) {
+                result.erase(result.size() - 1);
+            }
+            result += c;
+            while (i + 1 < dn.size() && dn[i + 1] == ' ') ++i;
+            continue;
+        }
+        result += tolower(c);
+    }
+    return result;
+}
+
+string entryCache::selector(const vector <string> &attributes) {
+/*
+  It returns sorted lower case attribute names, so the same set in any order is one key.
+*/
+    vector <string> sorted;
+    sorted.reserve(attributes.size());
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        string name = attributes[i];
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        sorted.push_back(name);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    string key;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        if (i > 0) key += ",";
+        key += sorted[i];
+    }
+    return key;
+}
+
+bool entryCache::get(const string &dn, const string &selector, map <string, vector<string> > &attrs) {
+/*
+  It sets attrs to cached lookup of dn and returns true, or returns false if it is missing or expired.
+*/
+    string key = normalize(dn);
+    entryCacheShard &shard = shared->shard(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    std::unordered_map <string, std::unordered_map <string, std::list<cachedLookup>::iterator> >::iterator dn_it = shard.index.find(key);
+    if (dn_it != shard.index.end()) {
+        std::unordered_map <string, std::list<cachedLookup>::iterator>::iterator it = dn_it->second.find(selector);
+        if (it != dn_it->second.end()) {
+            std::list<cachedLookup>::iterator lookup = it->second;
+            if (lookup->expires > time(NULL)) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, lookup);
+                attrs = lookup->attrs;
+                shared->hits++;
+                return true;
+            }
+            shard.erase(lookup);
+        }
+    }
+
+    shared->misses++;
+    return false;
+}
+
+string entryCache::findGUID(const string &guid) {
+/*
+  It returns normalized DN, that has cached lookups of object with objectGUID, empty if there is none.
+  Objects are not looked up by DN here, so all shards are asked, without bumping their generations.
+*/
+    for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) {
+        entryCacheShard &shard = shared->shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::unordered_map <string, string>::iterator it = shard.guids.find(guid);
+        if (it != shard.guids.end()) return it->second;
+    }
+    return "";
+}
+
+bool entryCache::requestGUID(vector <string> &attributes) {
+/*
+  It adds objectGUID to requested attributes, unless it is requested already (or all attributes are).
+  It returns true if it was added, so it is taken out of the result with takeGUID.
+*/
+    if (attributes.empty()) return false;
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        if (attributes[i] == "*" || upper(attributes[i]) == "OBJECTGUID") return false;
+    }
+    attributes.push_back("objectGUID");
+    return true;
+}
+
+string entryCache::takeGUID(map <string, vector<string> > &attrs, bool added) {
+/*
+  It returns objectGUID of looked up attributes, empty if it is missing. It is removed from attrs if added by requestGUID.
+*/
+    string guid;
+    for (map <string, vector<string> >::iterator it = attrs.begin(); it != attrs.end(); ++it) {
+        if (upper(it->first) != "OBJECTGUID") continue;
+        if (!it->second.empty()) guid = it->second[0];
+        if (added) attrs.erase(it);
+        break;
+    }
+    return guid;
+}
+
+uint64_t entryCache::generation(const string &dn) {
+/*
+  It returns generation of shard of dn, to be taken before the lookup is sent and passed to put.
+*/
+    entryCacheShard &shard = shared->shard(normalize(dn));
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.generation;
+}
+
+void entryCache::put(const string &dn, const string &selector, const map <string, vector<string> > &attrs, uint64_t generation, const string &guid) {
+/*
+  It stores lookup of dn, the least recently used lookups are evicted to stay within memory budget.
+  Lookup is dropped, if dn could have been invalidated since 'generation' was taken.
+  objectGUID of dn (if known) is kept as long as dn has cached lookups.
+*/
+    cachedLookup lookup;
+    lookup.dn = normalize(dn);
+    lookup.selector = selector;
+    lookup.attrs = attrs;
+    lookup.expires = time(NULL) + shared->ttl;
+
+    lookup.bytes = sizeof(cachedLookup) + 2 * lookup.dn.size() + 2 * selector.size() + 4 * cache_overhead;
+    for (map <string, vector<string> >::const_iterator it = attrs.begin(); it != attrs.end(); ++it) {
+        lookup.bytes += it->first.size() + cache_overhead;
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            lookup.bytes += it->second[i].size() + cache_overhead;
+        }
+    }
+
+    if (lookup.bytes > shared->max_shard_bytes) return;
+
+    entryCacheShard &shard = shared->shard(lookup.dn);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.generation != generation) return;
+
+    std::unordered_map <string, std::list<cachedLookup>::iterator> &selectors = shard.index[lookup.dn];
+    std::unordered_map <string, std::list<cachedLookup>::iterator>::iterator it = selectors.find(selector);
+    if (it != selectors.end()) {
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        selectors.erase(it);
+    }
+
+    shard.bytes += lookup.bytes;
+    shard.lru.push_front(lookup);
+    selectors[selector] = shard.lru.begin();
+    if (!guid.empty()) shard.remember(lookup.dn, guid);
+
+    while (shard.bytes > shared->max_shard_bytes && !shard.lru.empty()) {
+        shard.erase(--shard.lru.end());
+        shared->evictions++;
+    }
+}
+
+void entryCache::invalidate(string dn, bool subtree) {
+/*
+  It drops cached lookups of dn. With subtree, lookups of all DNs under dn are dropped too,
+  it scans all shards, as it is needed on renames only.
+*/
+    string key = normalize(dn);
+
+    entryCacheShard &shard = shared->shard(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.generation++;
+        std::unordered_map <string, std::unordered_map <string, std::list<cachedLookup>::iterator> >::iterator dn_it = shard.index.find(key);
+        if (dn_it != shard.index.end()) {
+            std::unordered_map <string, std::list<cachedLookup>::iterator> selectors = dn_it->second;
+            for (std::unordered_map <string, std::list<cachedLookup>::iterator>::iterator it = selectors.begin(); it != selectors.end(); ++it) {
+                shard.erase(it->second);
+            }
+        }
+    }
+
+    if (!subtree) return;
+
+    string suffix = "," + key;
+    for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) {
+        entryCacheShard &s = shared->shards[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.generation++;
+        for (std::list<cachedLookup>::iterator it = s.lru.begin(); it != s.lru.end(); ) {
+            std::list<cachedLookup>::iterator current = it++;
+            if (current->dn.size() > suffix.size() &&
+                current->dn.compare(current->dn.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                s.erase(current);
+            }
+        }
+    }
+}
+
+struct failedLookup {
+    string dn;
+    string selector;
+    int code;
+    string msg;
+    time_t expires;
+};
+
+struct negativeCache::state {
+    std::mutex mutex;
+    // the most recently used first
+    std::list <failedLookup> lru;
+    // normalized DN -> selector -> lookup
+    std::unordered_map <string, std::unordered_map <string, std::list<failedLookup>::iterator> > index;
+
+    // bumped on every invalidation of a DN with the same hash
+    uint64_t generations[ENTRY_CACHE_SHARDS];
+
+    size_t max_entries;
+    int ttl;
+
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+
+    state() : max_entries(0), ttl(0), hits(0), misses(0) {
+        for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) generations[i] = 0;
+    }
+
+    uint64_t &generation(const string &key) {
+        return generations[std::hash<string>()(key) % ENTRY_CACHE_SHARDS];
+    }
+
+    void bumpAll() {
+        for (size_t i = 0; i < ENTRY_CACHE_SHARDS; ++i) generations[i]++;
+    }
+
+    void erase(std::list<failedLookup>::iterator it) {
+        std::unordered_map <string, std::unordered_map <string, std::list<failedLookup>::iterator> >::iterator dn_it = index.find(it->dn);
+        if (dn_it != index.end()) {
+            dn_it->second.erase(it->selector);
+            if (dn_it->second.empty()) {
+                index.erase(dn_it);
+            }
+        }
+        lru.erase(it);
+    }
+};
+
+negativeCache::negativeCache(long max_entries, int ttl) :
+    shared(std::make_shared<state>()) {
+    shared->max_entries = std::max(max_entries, 0L);
+    shared->ttl = ttl;
+}
+
+long negativeCache::hits() { return shared->hits; }
+long negativeCache::misses() { return shared->misses; }
+
+long negativeCache::size() {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    return shared->lru.size();
+}
+
+void negativeCache::clear() {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->lru.clear();
+    shared->index.clear();
+    shared->bumpAll();
+}
+
+bool negativeCache::missing(int code) {
+    return code == OBJECT_NOT_FOUND || code == LDAP_NO_SUCH_OBJECT || code == ATTRIBUTE_ENTRY_NOT_FOUND;
+}
+
+bool negativeCache::get(const string &dn, const string &selector, int &code, string &msg) {
+/*
+  It returns true and sets code and msg of the failure, if lookup of dn has failed within ttl.
+*/
+    string key = entryCache::normalize(dn);
+
+    std::lock_guard<std::mutex> lock(shared->mutex);
+
+    std::unordered_map <string, std::unordered_map <string, std::list<failedLookup>::iterator> >::iterator dn_it = shared->index.find(key);
+    if (dn_it != shared->index.end()) {
+        std::unordered_map <string, std::list<failedLookup>::iterator>::iterator it = dn_it->second.find(selector);
+        if (it != dn_it->second.end()) {
+            std::list<failedLookup>::iterator lookup = it->second;
+            if (lookup->expires > time(NULL)) {
+                shared->lru.splice(shared->lru.begin(), shared->lru, lookup);
+                code = lookup->code;
+                msg = lookup->msg;
+                shared->hits++;
+                return true;
+            }
+            shared->erase(lookup);
+        }
+    }
+
+    shared->misses++;
+    return false;
+}
+
+uint64_t negativeCache::generation(const string &dn) {
+/*
+  It returns generation of dn, to be taken before the lookup is sent and passed to put.
+*/
+    string key = entryCache::normalize(dn);
+
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    return shared->generation(key);
+}
+
+void negativeCache::put(const string &dn, const string &selector, int code, const string &msg, uint64_t generation) {
+/*
+  It remembers failed lookup of dn, the least recently used ones are dropped above max_entries.
+  Lookup is dropped, if dn could have been invalidated since 'generation' was taken.
+*/
+    if (shared->max_entries == 0) return;
+
+    failedLookup lookup;
+    lookup.dn = entryCache::normalize(dn);
+    lookup.selector = selector;
+    lookup.code = code;
+    lookup.msg = msg;
+    lookup.expires = time(NULL) + shared->ttl;
+
+    std::lock_guard<std::mutex> lock(shared->mutex);
+
+    if (shared->generation(lookup.dn) != generation) return;
+
+    std::unordered_map <string, std::list<failedLookup>::iterator> &selectors = shared->index[lookup.dn];
+    std::unordered_map <string, std::list<failedLookup>::iterator>::iterator it = selectors.find(selector);
+    if (it != selectors.end()) {
+        shared->lru.erase(it->second);
+        selectors.erase(it);
+    }
+
+    shared->lru.push_front(lookup);
+    selectors[selector] = shared->lru.begin();
+
+    while (shared->lru.size() > shared->max_entries) {
+        shared->erase(--shared->lru.end());
+    }
+}
+
+void negativeCache::invalidate(string dn, bool subtree) {
+/*
+  It drops failed lookups of dn, and with subtree of all DNs under dn.
+*/
+    string key = entryCache::normalize(dn);
+    string suffix = "," + key;
+
+    std::lock_guard<std::mutex> lock(shared->mutex);
+
+    shared->generation(key)++;
+    std::unordered_map <string, std::unordered_map <string, std::list<failedLookup>::iterator> >::iterator dn_it = shared->index.find(key);
+    if (dn_it != shared->index.end()) {
+        std::unordered_map <string, std::list<failedLookup>::iterator> selectors = dn_it->second;
+        for (std::unordered_map <string, std::list<failedLookup>::iterator>::iterator it = selectors.begin(); it != selectors.end(); ++it) {
+            shared->erase(it->second);
+        }
+    }
+
+    if (!subtree) return;
+
+    shared->bumpAll();
+
+    for (std::list<failedLookup>::iterator it = shared->lru.begin(); it != shared->lru.end(); ) {
+        std::list<failedLookup>::iterator current = it++;
+        if (current->dn.size() > suffix.size() &&
+            current->dn.compare(current->dn.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            shared->erase(current);
+        }
+    }
+}
+
+void client::setEntryCache(const entryCache &_cache) {
+    cache.reset(new entryCache(_cache));
+}
+
+void client::setNegativeCache(const negativeCache &_missing) {
+    missing.reset(new negativeCache(_missing));
+}
+
+void client::invalidate(string dn, bool subtree) {
+/*
+  It drops cached lookups, that are changed by an operation of this client.
+  Failed lookups are dropped too, as the operation could have added a missing attribute.
+*/
+    if (cache) {
+        cache->invalidate(dn, subtree);
+    }
+    if (missing) {
+        missing->invalidate(dn, subtree);
+    }
+}
+
+void client::invalidateRenamed(string dn, string newrdn, string newparent) {
+/*
+  It drops cached lookups of renamed (or moved) dn and its subtree,
+  and failed lookups of the new DN, that exists now.
+*/
+    invalidate(dn, true);
+
+    if (newparent.empty()) {
+        size_t comma = dn.find(',');
+        while (comma != string::npos && comma > 0 && dn[comma - 1] == '\\') {
+            comma = dn.find(',', comma + 1);
+        }
+        newparent = (comma == string::npos) ? "" : dn.substr(comma + 1);
+    }
+    invalidate(newparent.empty() ? newrdn : newrdn + "," + newparent, true);
+}
+
+void client::invalidateChanged(string dn, string guid) {
+/*
+  It drops cached lookups of object changed by another connection, as reported by change notification
+  or sync. AD reports renames and moves under the new DN, and deletes under the tombstone DN (or by
+  objectGUID only, dn is empty then), the old DN is found by objectGUID among cached lookups.
+  Only a known renamed object has its subtree dropped.
+*/
+    string old = (cache && !guid.empty()) ? cache->findGUID(guid) : "";
+    bool renamed = !old.empty() && old != entryCache::normalize(dn);
+    if (renamed) {
+        invalidate(old, true);
+    }
+    if (!dn.empty()) {
+        invalidate(dn, renamed);
+    }
+}
@@ -1,8 +1,16 @@
 #include "stdlib.h"
+#include <thread>
+#include <condition_variable>
+
 #include "client.h"
 
 clientLogger *log = new clientLogger();
 
+// default logger, and loggers replaced by setLogger, other threads could still be using them
+static clientLogger *default_logger = log;
+static std::vector <clientLogger *> retired_loggers;
+static std::mutex logger_mutex;
+
 /*
   Active Directory class.
 
@@ -18,14 +26,15 @@ client::client() {
   Constructor, to initialize default values of global variables.
 */
     ds = NULL;
+    names = attributeNames::shared();
 }
 
 client::~client() {
 /*
   Destructor, to automaticaly free initial values allocated at bind().
 */
+    asyncShutdown();
     close(ds);
-    delLogger();
 }
 
 void client::close(LDAP *ds) {
@@ -34,9 +43,100 @@ void client::close(LDAP *ds) {
     }
 }
 
+void client::delLogger() {
+/*
+  It restores the default logger.
+*/
+    setLogger(NULL);
+}
+
+void client::setLogger(clientLogger *fn) {
+/*
+  It replaces process-wide logger. Dispatcher, renewer or listener threads could be logging
+  through the old one right now, so it is retired instead of deleted.
+*/
+    std::lock_guard<std::mutex> lock(logger_mutex);
+
+    if (fn == NULL) fn = default_logger;
+    if (fn == log) return;
+    if (log != default_logger) {
+        retired_loggers.push_back(log);
+    }
+    log = fn;
+}
+
 void client::bind(clientConnParams _params) {
+    connect(_params, "");
+}
+
+void client::reconnect() {
+/*
+  It re-establishes a lost session: binds again with params of the last bind (GSSAPI included),
+  preferring servers other than the one that has dropped the session.
+  It throws BindException if no server could be bound.
+*/
+    if (params.uries.empty()) throw BindException("Client has never been bound", PARAMS_ERROR);
+
+    string dropped_uri = params.uri;
+    // dispatcher could be reading from the handle, it is stopped before the handle is freed
+    asyncShutdown();
+    close(ds);
+    ds = NULL;
+
+    connect(params, dropped_uri);
+}
+
+bool client::retryRead(int result, int attempt) {
+/*
+  It returns true if a read, that has failed with result on attempt (0 for the first one),
+  could be sent again: the session was lost and it has been re-established.
+*/
+    if (attempt >= params.read_retries) return false;
+    if (result != LDAP_SERVER_DOWN && result != LDAP_CONNECT_ERROR) return false;
+
+    try {
+        reconnect();
+    } catch (BindException &ex) {
+        log->error("Reconnect after lost session has failed: " + ex.msg);
+        return false;
+    }
+    return true;
+}
+
+void client::connect(clientConnParams _params, string dropped_uri) {
+/*
+  It binds to the first available server of _params.uries, dropped_uri (if any) is tried last.
+*/
+    asyncShutdown();
+
     ldap_prefix = _params.use_ldaps ? "ldaps" : "ldap";
 
+    if (_params.uries.size() > 1) {
+        if (_params.probe_timeout_ms > 0) {
+            vector <string> probe_uries;
+            for (size_t i = 0; i < _params.uries.size(); ++i) {
+                probe_uries.push_back(_params.uries[i].find("://") == string::npos ? ldap_prefix + "://" + _params.uries[i] : _params.uries[i]);
+            }
+            probe(probe_uries, _params.probe_timeout_ms);
+        }
+        // fastest healthy DCs (of the site) first
+        _params.uries = dcScoreboard::instance().rank(_params.uries, _params.site);
+
+        if (!dropped_uri.empty()) {
+            string dropped = dcScoreboard::key(dropped_uri);
+            std::stable_partition(_params.uries.begin(), _params.uries.end(), [&dropped](const string &uri) {
+                return dcScoreboard::key(uri) != dropped;
+            });
+        }
+    }
+
+    if (_params.connect_stagger_ms != CONNECT_SEQUENTIAL && _params.uries.size() > 1) {
+        close(ds);
+        ds = NULL;
+        bindParallel(_params);
+        return;
+    }
+
     if (!_params.uries.empty()) {
         for (vector <string>::iterator it = _params.uries.begin(); it != _params.uries.end(); ++it) {
             if (it->find("://") == string::npos) {
@@ -44,6 +144,8 @@ void client::bind(clientConnParams _params) {
             } else {
                 _params.uri = *it;
             }
+            // takes the trial, if the breaker of the server is half-open
+            dcScoreboard::instance().available(_params.uri);
             try {
                 bind(&ds, _params);
                 params = _params;
@@ -68,6 +170,106 @@ void client::bind(clientConnParams _params) {
     }
 }
 
+/*
+  State of parallel connection attempts, shared with attempt threads.
+  Attempts, that complete after the winner, close their connections themselves.
+*/
+struct bindRace {
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    size_t attempts;
+    size_t failed;
+    bool decided;
+
+    LDAP *winner;
+    clientConnParams winner_params;
+    std::exception_ptr last_error;
+
+    bindRace() : attempts(0), failed(0), decided(false), winner(NULL) {}
+};
+
+void client::bindAttempt(std::shared_ptr<bindRace> race, size_t index, clientConnParams _params, int stagger_ms) {
+/*
+  It waits for its turn, connects and binds, and reports result to race.
+  Next attempt starts before its turn if an attempt has failed.
+*/
+    {
+        std::unique_lock<std::mutex> lock(race->mutex);
+        race->cv.wait_for(lock, std::chrono::milliseconds(stagger_ms * index), [&] {
+            return race->decided || race->failed >= index;
+        });
+        if (race->decided) {
+            return;
+        }
+    }
+
+    // takes the trial, if the breaker of the server is half-open
+    dcScoreboard::instance().available(_params.uri);
+
+    LDAP *ld = NULL;
+    try {
+        bind(&ld, _params);
+    } catch (...) {
+        close(ld);
+
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->failed++;
+        race->last_error = std::current_exception();
+        race->cv.notify_all();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    if (race->decided) {
+        // lost the race
+        lock.unlock();
+        close(ld);
+        return;
+    }
+    race->decided = true;
+    race->winner = ld;
+    race->winner_params = _params;
+    race->cv.notify_all();
+}
+
+void client::bindParallel(clientConnParams &_params) {
+/*
+  It starts connection attempts to all uries, each one stagger_ms after the previous
+  (or right away if an attempt has failed), and keeps the first bound connection.
+  Slower attempts are not waited for, they are closed as soon as they complete.
+*/
+    std::shared_ptr<bindRace> race = std::make_shared<bindRace>();
+    race->attempts = _params.uries.size();
+
+    for (size_t i = 0; i < _params.uries.size(); ++i) {
+        clientConnParams attempt_params = _params;
+        if (_params.uries[i].find("://") == string::npos) {
+            attempt_params.uri = ldap_prefix + "://" + _params.uries[i];
+        } else {
+            attempt_params.uri = _params.uries[i];
+        }
+        std::thread(bindAttempt, race, i, attempt_params, _params.connect_stagger_ms).detach();
+    }
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    race->cv.wait(lock, [&] {
+        return race->decided || race->failed == race->attempts;
+    });
+
+    if (!race->decided) {
+        race->decided = true;
+        race->cv.notify_all();
+        if (race->last_error) {
+            std::rethrow_exception(race->last_error);
+        }
+        throw BindException("No suitable connection uries found", PARAMS_ERROR);
+    }
+
+    ds = race->winner;
+    params = race->winner_params;
+}
+
 void client::bind(vector <string> uries, string binddn, string bindpw, string search_base, bool secured) {
 /*
   Wrapper around bind to support list of uries
@@ -103,6 +305,9 @@ void client::bind(LDAP **ds, clientConnParams& _params) {
     close(*ds);
 
     int result, version, bindresult = -1;
+    // false when bind has failed before anything was sent, the server is not to blame then
+    bool sent = true;
+    double started = now_ms();
 
     string error_msg;
 
@@ -144,6 +349,19 @@ void client::bind(LDAP **ds, clientConnParams& _params) {
         }
     }
 
+#ifdef LDAP_OPT_X_KEEPALIVE_IDLE
+    // TCP keepalive, so that idle sessions dropped by firewalls or NAT are detected
+    if (_params.keepalive_idle > 0) {
+        ldap_set_option(*ds, LDAP_OPT_X_KEEPALIVE_IDLE, &_params.keepalive_idle);
+    }
+    if (_params.keepalive_probes > 0) {
+        ldap_set_option(*ds, LDAP_OPT_X_KEEPALIVE_PROBES, &_params.keepalive_probes);
+    }
+    if (_params.keepalive_interval > 0) {
+        ldap_set_option(*ds, LDAP_OPT_X_KEEPALIVE_INTERVAL, &_params.keepalive_interval);
+    }
+#endif
+
     if (_params.timelimit != -1) {
         result = ldap_set_option(*ds, LDAP_OPT_TIMELIMIT, &_params.timelimit);
         if (result != LDAP_OPT_SUCCESS) {
@@ -171,6 +389,9 @@ void client::bind(LDAP **ds, clientConnParams& _params) {
     if (_params.use_tls) {
         result = ldap_start_tls_s(*ds, NULL, NULL);
         if (result != LDAP_SUCCESS) {
+            if (dcScoreboard::serverFailure(result)) {
+                dcScoreboard::instance().failure(_params.uri);
+            }
             error_msg = "Error in ldap_start_tls_s: ";
             error_msg.append(ldap_err2string(result));
             throw BindException(error_msg, SERVER_CONNECT_FAILURE);
@@ -183,18 +404,21 @@ void client::bind(LDAP **ds, clientConnParams& _params) {
     if (_params.secured) {
 #ifdef KRB5
         if (_params.use_gssapi) {
-            krb_struct krb_param;
-            if (krb5_create_cache(_params.domain.c_str(), &krb_param, _params.krb5_ccache_name, _params.krb5_keytab_name) == 0) {
+            // TGT is cached across binds, so a bind costs a service ticket request at most.
+            // Credential cache is passed down to the bind, GSSAPI binds of any realm could run in parallel.
+            const char *ccache = NULL;
+            if (krb5Credentials::instance().acquire(_params.domain.c_str(), _params.krb5_ccache_name, _params.krb5_keytab_name, &ccache) == 0) {
                 _params.login_method = "GSSAPI";
 
-                bindresult = sasl_bind_gssapi(*ds);
+                bindresult = sasl_bind_gssapi(*ds, ccache);
                 if (bindresult == LDAP_SUCCESS) {
-                    ldap_set_rebind_proc(*ds, sasl_rebind_gssapi, NULL);
+                    ldap_set_rebind_proc(*ds, sasl_rebind_gssapi, (void *) ccache);
                 }
-
-                krb5_cleanup(krb_param);
             } else {
-                bindresult = -1;
+                // keytab or KDC problem, nothing has been sent to the server
+                _params.login_method = "GSSAPI";
+                bindresult = LDAP_LOCAL_ERROR;
+                sent = false;
             }
         } else {
 #endif
@@ -209,91 +433,354 @@ void client::bind(LDAP **ds, clientConnParams& _params) {
     }
 
     if (bindresult != LDAP_SUCCESS) {
+        if (sent && dcScoreboard::serverFailure(bindresult)) {
+            dcScoreboard::instance().failure(_params.uri);
+        }
         error_msg = "Error while " + _params.login_method + " ldap binding to " + _params.uri + ": ";
-        error_msg.append(ldap_err2string(bindresult));
+        error_msg.append(sent ? ldap_err2string(bindresult) : "failed to acquire Kerberos credentials for " + _params.domain);
         throw BindException(error_msg, SERVER_CONNECT_FAILURE);
     }
+    dcScoreboard::instance().success(_params.uri, now_ms() - started);
+}
+
+bool client::ping() {
+/*
+  Cheap liveness probe: base search of rootDSE, that returns no attributes.
+  It returns true if server has answered.
+*/
+    if (ds == NULL) return false;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+    char *attrs[] = {"1.1", NULL};
+#pragma GCC diagnostic pop
+    LDAPMessage *res = NULL;
+
+    double started = now_ms();
+    int result = ldap_search_ext_s(ds, "", LDAP_SCOPE_BASE, "(objectclass=*)", attrs, 1, NULL, NULL, NULL, 1, &res);
+    ldap_msgfree(res);
+    observe(started, result);
+
+    return (result == LDAP_SUCCESS);
+}
+
+map <string, vector <string> > client::rootDSE(const vector <string> &attributes) {
+/*
+  It returns attributes of rootDSE.
+*/
+    attributeList attrs(attributes);
+    LDAPMessage *res = NULL;
+
+    int result;
+    for (int attempt = 0; ; ++attempt) {
+        double started_ms = now_ms();
+        result = ldap_search_ext_s(ds, "", LDAP_SCOPE_BASE, "(objectclass=*)", attrs.get(), 0, NULL, NULL, NULL, 1, &res);
+        observe(started_ms, result);
+        if (result == LDAP_SUCCESS || !retryRead(result, attempt)) break;
+        ldap_msgfree(res);
+        res = NULL;
+    }
+    if (result != LDAP_SUCCESS) {
+        ldap_msgfree(res);
+        throw SearchException(string("Error in rootDSE ldap_search_ext_s: ") + ldap_err2string(result), result);
+    }
+
+    map <string, vector <string> > values;
+    LDAPMessage *entry = ldap_first_entry(ds, res);
+    try {
+        if (entry != NULL) values = _getvalues(entry);
+    } catch (...) {
+        ldap_msgfree(res);
+        throw;
+    }
+    ldap_msgfree(res);
+
+    return values;
 }
 
 map < string, map < string, vector<string> > > client::search(string DN, int scope, string filter, const vector <string> &attributes) {
+/*
+  Wrapper around search with default search params.
+*/
+    return search(DN, scope, filter, attributes, clientSearchParams());
+}
+
+ber_int_t client::initial_pagesize(const clientSearchParams &sparams) {
+/*
+  It returns page size for the first page of a paged search.
+*/
+    int pagesize = (sparams.pagesize == PAGESIZE_DEFAULT) ? params.pagesize : sparams.pagesize;
+
+    if (pagesize == PAGESIZE_ADAPTIVE) {
+        return std::min(ADAPTIVE_INITIAL_PAGESIZE, std::max(params.max_pagesize, 1));
+    }
+    if (pagesize <= 0) {
+        throw SearchException("Wrong page size: " + itos(pagesize), PARAMS_ERROR);
+    }
+    return pagesize;
+}
+
+ber_int_t client::adaptive_pagesize(ber_int_t pagesize, size_t page_bytes, int page_entries) {
+/*
+  It returns page size for the next page in adaptive mode.
+  Page size is at most doubled at once, it never exceeds max_pagesize,
+  and estimated page size (by bytes per entry seen so far) stays within page_memory_budget.
+*/
+    if (page_entries <= 0 || page_bytes == 0) {
+        return pagesize;
+    }
+
+    size_t bytes_per_entry = page_bytes / page_entries + 1;
+    long budget_entries = params.page_memory_budget / (long) bytes_per_entry;
+
+    long next = std::min((long) pagesize * 2, budget_entries);
+    next = std::min(next, (long) params.max_pagesize);
+    return (ber_int_t) std::max(next, 1L);
+}
+
+map < string, map < string, vector<string> > > client::search(string DN, int scope, string filter, const vector <string> &attributes, const clientSearchParams &sparams) {
 /*
   General search function.
   It returns map with users found with 'filter' with specified 'attributes'.
 */
+    for (int attempt = 0; ; ++attempt) {
+        searchCursor cursor(this, DN, scope, filter, attributes, sparams);
+
+        searchResultSet search_result(names);
+        try {
+            while (cursor.fetch(search_result));
+        } catch (SearchException &ex) {
+            // session was lost after the first page, search starts over in a new one
+            if (cursor.started && retryRead(ex.code, attempt)) continue;
+            throw;
+        }
+
+        return search_result.toMap();
+    }
+}
+
+searchCursor *client::openSearch(string search_base, string filter, int scope, const vector <string> &attributes) {
+/*
+  Wrapper around openSearch with default search params.
+*/
+    return openSearch(search_base, filter, scope, attributes, clientSearchParams());
+}
+
+searchCursor *client::openSearch(string search_base, string filter, int scope, const vector <string> &attributes, const clientSearchParams &sparams) {
+/*
+  It returns cursor, that fetches entries found with 'filter' page by page.
+  Caller owns returned cursor, it must be deleted before the client.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    return new searchCursor(this, search_base, scope, filter, attributes, sparams);
+}
+
+searchCursor::searchCursor(client *_owner, string _search_base, int _scope, string _filter, const vector <string> &attributes, const clientSearchParams &sparams) {
+/*
+  Constructor, to prepare paged search. Nothing is sent to server until next().
+*/
+    if (attributes.size() > 50) throw SearchException("Cant return more than 50 attributes", PARAMS_ERROR);
+
+    owner = _owner;
+    search_base = _search_base;
+    scope = _scope;
+    filter = _filter;
+    replace(filter, "\\", "\\\\");
 
+    pagesize = owner->initial_pagesize(sparams);
+    adaptive = (sparams.pagesize == PAGESIZE_ADAPTIVE) ||
+               (sparams.pagesize == PAGESIZE_DEFAULT && owner->params.pagesize == PAGESIZE_ADAPTIVE);
+    search_params = sparams;
+    if (sparams.vlv_offset > 0 && sparams.sort.empty()) {
+        throw SearchException("Virtual list view needs sort keys", PARAMS_ERROR);
+    }
+
+    cookie = NULL;
+    started = false;
+    done = false;
+    current = searchResultSet(owner->names);
+
+    attrs = new char*[attributes.size() + 1];
+    size_t i;
+    for (i = 0; i < attributes.size(); ++i) {
+        attrs[i] = strdup(attributes[i].c_str());
+    }
+    attrs[i] = NULL;
+}
+
+searchCursor::~searchCursor() {
+/*
+  Destructor, to abandon unfinished paged search and free allocated values.
+*/
+    close();
+
+    for (size_t i = 0; attrs[i] != NULL; ++i) {
+        free(attrs[i]);
+    }
+    delete[] attrs;
+}
+
+void searchCursor::close() {
+/*
+  It tells server to drop paged search state (page size 0 with current cookie), if search is unfinished.
+  Errors are ignored, as nothing could be done with them here.
+*/
+    if (!done && cookie != NULL && owner->ds != NULL) {
+        LDAPControl *serverctrls[2] = { NULL, NULL };
+        LDAPMessage *res = NULL;
+
+        if (ldap_create_page_control(owner->ds, 0, cookie, 0, &serverctrls[0]) == LDAP_SUCCESS) {
+            ldap_search_ext_s(owner->ds, search_base.c_str(), scope, filter.c_str(), attrs, 0, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &res);
+            ldap_msgfree(res);
+            ldap_control_free(serverctrls[0]);
+        }
+    }
+
+    if (cookie != NULL) {
+        ber_bvfree(cookie);
+        cookie = NULL;
+    }
+    done = true;
+    current.clear();
+}
+
+bool searchCursor::next() {
+/*
+  It fetches next page of entries, which replaces previous one.
+  It returns false when there are no more pages.
+*/
+    current.clear();
+    return fetch(current);
+}
+
+bool searchCursor::fetch(searchResultSet &into) {
+/*
+  It fetches next page of entries and appends them to 'into'.
+  It returns false when there are no more pages.
+*/
+    if (done) return false;
+
+    LDAP *ds = owner->ds;
     if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
 
     int result, errcodep;
-
-    char *attrs[50];
     int attrsonly = 0;
+    int iscritical = 1;
 
     string error_msg = "";
 
-    ber_int_t       pagesize = 2;
     ber_int_t       totalcount;
-    struct berval   *cookie = NULL;
-    int             iscritical = 1;
 
-    LDAPControl     *serverctrls[2] = { NULL, NULL };
+    LDAPControl     *serverctrls[4] = { NULL, NULL, NULL, NULL };
     LDAPControl     *pagecontrol = NULL;
+    LDAPControl     *deletedcontrol = NULL;
+    LDAPControl     *sortcontrol = NULL;
+    LDAPControl     *vlvcontrol = NULL;
     LDAPControl     **returnedctrls = NULL;
 
     LDAPMessage *res = NULL;
     LDAPMessage *entry;
 
-    char *dn;
+    size_t fetched_entries = into.size();
+    size_t fetched_bytes = into.bytes();
 
-    bool morepages;
+    // virtual list view returns a single window, it is not paged
+    bool vlv = search_params.vlv_offset > 0;
 
-    map < string, map < string, vector<string> > > search_result;
-
-    if (attributes.size() > 50) throw SearchException("Cant return more than 50 attributes", PARAMS_ERROR);
-
-    unsigned int i;
-    for (i = 0; i < attributes.size(); ++i) {
-        attrs[i] = strdup(attributes[i].c_str());
-    }
-    attrs[i] = NULL;
+    do {
+        int nctrls = 0;
+        if (search_params.show_deleted) {
+            // control has no value, servers without it return live objects only
+            result = ldap_control_create(LDAP_CONTROL_X_SHOW_DELETED, 0, NULL, 0, &deletedcontrol);
+            if (result != LDAP_SUCCESS) {
+                error_msg = "Failed to create show deleted control: ";
+                error_msg.append(ldap_err2string(result));
+                break;
+            }
+            serverctrls[nctrls++] = deletedcontrol;
+        }
 
-    replace(filter, "\\", "\\\\");
+        if (!search_params.sort.empty()) {
+            LDAPSortKey **sortkeys = NULL;
+            result = ldap_create_sort_keylist(&sortkeys, const_cast<char *>(search_params.sort.c_str()));
+            if (result == LDAP_SUCCESS) {
+                result = ldap_create_sort_control(ds, sortkeys, iscritical, &sortcontrol);
+                ldap_free_sort_keylist(sortkeys);
+            }
+            if (result != LDAP_SUCCESS) {
+                error_msg = "Failed to create sort control for '" + search_params.sort + "': ";
+                error_msg.append(ldap_err2string(result));
+                break;
+            }
+            serverctrls[nctrls++] = sortcontrol;
+        }
 
-    do {
-        result = ldap_create_page_control(ds, pagesize, cookie, iscritical, &pagecontrol);
-        if (result != LDAP_SUCCESS) {
-            error_msg = "Failed to create page control: ";
-            error_msg.append(ldap_err2string(result));
-            break;
+        if (vlv) {
+            LDAPVLVInfo vlvinfo;
+            vlvinfo.ldvlv_version = 1;
+            vlvinfo.ldvlv_before_count = search_params.vlv_before;
+            vlvinfo.ldvlv_after_count = search_params.vlv_after;
+            vlvinfo.ldvlv_offset = search_params.vlv_offset;
+            vlvinfo.ldvlv_count = search_params.vlv_content_count;
+            vlvinfo.ldvlv_attrvalue = NULL;
+            vlvinfo.ldvlv_context = NULL;
+            vlvinfo.ldvlv_extradata = NULL;
+
+            result = ldap_create_vlv_control(ds, &vlvinfo, &vlvcontrol);
+            if (result != LDAP_SUCCESS) {
+                error_msg = "Failed to create VLV control: ";
+                error_msg.append(ldap_err2string(result));
+                break;
+            }
+            serverctrls[nctrls++] = vlvcontrol;
+        } else {
+            result = ldap_create_page_control(ds, pagesize, cookie, iscritical, &pagecontrol);
+            if (result != LDAP_SUCCESS) {
+                error_msg = "Failed to create page control: ";
+                error_msg.append(ldap_err2string(result));
+                break;
+            }
+            serverctrls[nctrls++] = pagecontrol;
         }
-        serverctrls[0] = pagecontrol;
 
         /* Search for entries in the directory using the parmeters.       */
-        result = ldap_search_ext_s(ds, DN.c_str(), scope, filter.c_str(), attrs, attrsonly, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &res);
+        // pages take as long as their size, they are not latency samples
+        result = ldap_search_ext_s(ds, search_base.c_str(), scope, filter.c_str(), attrs, attrsonly, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &res);
+        owner->observe(result);
+
+        // the first page could be asked again in a new session, later ones need the cookie of the lost session
+        for (int attempt = 0; !started && owner->retryRead(result, attempt); ++attempt) {
+            ldap_msgfree(res);
+            res = NULL;
+            ds = owner->ds;
+
+            result = ldap_search_ext_s(ds, search_base.c_str(), scope, filter.c_str(), attrs, attrsonly, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &res);
+            owner->observe(result);
+        }
+        if (pagecontrol != NULL) ldap_control_free(pagecontrol);
+        pagecontrol = NULL;
         if ((result != LDAP_SUCCESS) & (result != LDAP_PARTIAL_RESULTS)) {
             error_msg = "Error in paged ldap_search_ext_s: ";
             error_msg.append(ldap_err2string(result));
             break;
         }
-        serverctrls[0] = NULL;
-        ldap_control_free(pagecontrol);
-        pagecontrol = NULL;
 
         int num_results = ldap_count_entries(ds, res);
-        if (num_results == 0) {
+        if (num_results == 0 && !started) {
             error_msg = filter + " not found";
             result = OBJECT_NOT_FOUND;
             break;
         }
 
-        map < string, vector<string> > valuesmap;
-
         for ( entry = ldap_first_entry(ds, res);
               entry != NULL;
               entry = ldap_next_entry(ds, entry) ) {
-            dn = ldap_get_dn(ds, entry);
-            valuesmap = _getvalues(entry);
-            search_result[dn] = valuesmap;
-            ldap_memfree(dn);
+            owner->_appendentry(entry, into);
+        }
+
+        if (adaptive) {
+            pagesize = owner->adaptive_pagesize(pagesize, into.bytes() - fetched_bytes, num_results);
         }
 
         /* Parse the results to retrieve the contols being returned.      */
@@ -304,6 +791,45 @@ map < string, map < string, vector<string> > > client::search(string DN, int sco
             break;
         }
 
+        if (!search_params.sort.empty()) {
+            LDAPControl *sortresponse = ldap_control_find(LDAP_CONTROL_SORTRESPONSE, returnedctrls, NULL);
+            ber_int_t sortresult = LDAP_SUCCESS;
+            char *sortattribute = NULL;
+            if (sortresponse != NULL && ldap_parse_sortresponse_control(ds, sortresponse, &sortresult, &sortattribute) == LDAP_SUCCESS) {
+                ldap_memfree(sortattribute);
+            }
+            if (sortresult != LDAP_SUCCESS) {
+                error_msg = "Server has failed to sort entries: ";
+                error_msg.append(ldap_err2string(sortresult));
+                result = sortresult;
+                break;
+            }
+        }
+
+        if (vlv) {
+            LDAPControl *vlvresponse = ldap_control_find(LDAP_CONTROL_VLVRESPONSE, returnedctrls, NULL);
+            if (vlvresponse == NULL) {
+                error_msg = "Failed to find VLVRESPONSE control";
+                result = 255;
+                break;
+            }
+
+            ber_int_t target_position, content_count;
+            struct berval *context = NULL;
+            int vlvresult;
+            result = ldap_parse_vlvresponse_control(ds, vlvresponse, &target_position, &content_count, &context, &vlvresult);
+            ber_bvfree(context);
+            if (result == LDAP_SUCCESS) result = vlvresult;
+            if (result != LDAP_SUCCESS) {
+                error_msg = "Failed to get VLV window: ";
+                error_msg.append(ldap_err2string(result));
+                break;
+            }
+            into.setVlvResult(target_position, content_count);
+            done = true;
+            break;
+        }
+
         /* Parse the page control returned to get the cookie and          */
         /* determine whether there are more pages.                        */
         pagecontrol = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, returnedctrls, NULL);
@@ -315,6 +841,7 @@ map < string, map < string, vector<string> > > client::search(string DN, int sco
 
         struct berval newcookie;
         result = ldap_parse_pageresponse_control(ds, pagecontrol, &totalcount, &newcookie);
+        pagecontrol = NULL;
         if (result != LDAP_SUCCESS) {
             error_msg = "Failed to parse pageresponse control: ";
             error_msg.append(ldap_err2string(result));
@@ -323,40 +850,45 @@ map < string, map < string, vector<string> > > client::search(string DN, int sco
         ber_bvfree(cookie);
         cookie = reinterpret_cast<berval*>(ber_memalloc( sizeof( struct berval ) ));
         if (cookie == NULL) {
+            ber_memfree(newcookie.bv_val);
             error_msg = "Failed to allocate memory for cookie";
             result = 255;
             break;
         }
         *cookie = newcookie;
 
-        /* Cleanup the controls used. */
-        ldap_controls_free(returnedctrls);
-        returnedctrls = NULL;
-
         /* Determine if the cookie is not empty, indicating there are more pages for these search parameters. */
-        if (cookie->bv_val != NULL && (strlen(cookie->bv_val) > 0)) {
-            morepages = true;
-        } else {
-            morepages = false;
+        if (cookie->bv_val == NULL || cookie->bv_len == 0) {
+            ber_bvfree(cookie);
+            cookie = NULL;
+            done = true;
         }
+    } while (false);
 
-        ldap_msgfree(res);
-    } while (morepages);
+    /* Cleanup the controls used. */
+    if (deletedcontrol != NULL) ldap_control_free(deletedcontrol);
+    if (sortcontrol != NULL) ldap_control_free(sortcontrol);
+    if (vlvcontrol != NULL) ldap_control_free(vlvcontrol);
+    ldap_controls_free(returnedctrls);
+    ldap_msgfree(res);
 
-    for (i = 0; i < attributes.size(); ++i) {
-        free(attrs[i]);
+    if (!error_msg.empty()) {
+        // server has dropped paged search state on error, nothing to abandon
+        if (cookie != NULL) {
+            ber_bvfree(cookie);
+            cookie = NULL;
+        }
+        done = true;
+        current.clear();
+        throw SearchException(error_msg, result);
     }
 
-    if (cookie != NULL) {
-        ber_bvfree(cookie);
-    }
+    started = true;
 
-    if (error_msg.empty()) {
-        return search_result;
-    } else {
-        ldap_msgfree(res);
-        throw SearchException(error_msg, result);
-    }
+    // page response is freed, remaining ranges could be fetched now
+    owner->_resolveranges(into, fetched_entries);
+
+    return into.size() > fetched_entries || !done;
 }
 
 bool client::ifDNExists(string dn) {
@@ -369,23 +901,67 @@ bool client::ifDNExists(string dn) {
 bool client::ifDNExists(string dn, string objectclass) {
 /*
   It returns true of false depends on object DN existence.
+  It is a base search limited to one entry, so DN of a container costs no more than a leaf.
 */
     int result;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wwrite-strings"
     char *attrs[] = {"1.1", NULL};
+    // cached objects are known by objectGUID too, see entryCache::findGUID
+    char *guid_attrs[] = {"objectGUID", NULL};
 #pragma GCC diagnostic pop
     LDAPMessage *res;
     string error_msg;
-    int attrsonly = 1;
+    string guid;
 
     if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
 
+    map < string, vector<string> > cached;
+    string selector = "?exists:" + objectclass;
+    std::transform(selector.begin(), selector.end(), selector.begin(), ::tolower);
+    if (cache && cache->get(dn, selector, cached)) {
+        return true;
+    }
+    int code;
+    string msg;
+    if (missing && missing->get(dn, selector, code, msg)) {
+        return false;
+    }
+
+    // changes made meanwhile by other clients of the cache must not be overwritten with this lookup
+    uint64_t generation = cache ? cache->generation(dn) : 0;
+    uint64_t missing_generation = missing ? missing->generation(dn) : 0;
+
     string filter = "(objectclass=" + objectclass + ")";
-    result = ldap_search_ext_s(ds, dn.c_str(), LDAP_SCOPE_SUBTREE, filter.c_str(), attrs, attrsonly, NULL, NULL, NULL, LDAP_NO_LIMIT, &res);
-    ldap_msgfree(res);
+    int found = 0;
+    for (int attempt = 0; ; ++attempt) {
+        res = NULL;
+        double started_ms = now_ms();
+        result = ldap_search_ext_s(ds, dn.c_str(), LDAP_SCOPE_BASE, filter.c_str(), cache ? guid_attrs : attrs, 0, NULL, NULL, NULL, 1, &res);
+        observe(started_ms, result);
+        if (result == LDAP_SUCCESS) {
+            // existing object of other objectclass is not found
+            found = ldap_count_entries(ds, res);
+            LDAPMessage *entry = (found > 0 && cache) ? ldap_first_entry(ds, res) : NULL;
+            struct berval **vals = (entry != NULL) ? ldap_get_values_len(ds, entry, "objectGUID") : NULL;
+            if (vals != NULL) {
+                if (vals[0] != NULL) guid.assign(vals[0]->bv_val, vals[0]->bv_len);
+                ldap_value_free_len(vals);
+            }
+        }
+        ldap_msgfree(res);
+        if (!retryRead(result, attempt)) break;
+    }
+    bool exists = (result == LDAP_SUCCESS && found > 0);
 
-    return (result == LDAP_SUCCESS);
+    if (cache && exists) {
+        cache->put(dn, selector, cached, generation, guid);
+    }
+    if (missing && negativeCache::missing(result)) {
+        missing->put(dn, selector, result, "", missing_generation);
+    }
+
+    return exists;
 }
 
 vector <string> client::searchDN(string search_base, string filter, int scope) {
@@ -431,45 +1007,83 @@ vector <string> client::search(string search_base, string filter, int scope, con
     return result;
 }
 
+map < string, map < string, vector<string> > > client::searchEntries(string search_base, string filter, int scope, const vector <string> &attributes) {
+/*
+  It returns map of DNs found with 'filter' to their 'attributes',
+  collected from the same paged search, without extra per-DN lookups.
+*/
+    return search(search_base, scope, filter, attributes);
+}
+
+map < string, map < string, vector<string> > > client::searchEntries(string search_base, string filter, int scope, const vector <string> &attributes, const clientSearchParams &sparams) {
+/*
+  Same as above, with per-request search params (e.g. page size).
+*/
+    return search(search_base, scope, filter, attributes, sparams);
+}
+
+searchResultSet *client::searchResults(string search_base, string filter, int scope, const vector <string> &attributes) {
+/*
+  Wrapper around searchResults with default search params.
+*/
+    return searchResults(search_base, filter, scope, attributes, clientSearchParams());
+}
+
+searchResultSet *client::searchResults(string search_base, string filter, int scope, const vector <string> &attributes, const clientSearchParams &sparams) {
+/*
+  It returns entries found with 'filter' with specified 'attributes', in server order.
+  Caller owns returned result set.
+*/
+    for (int attempt = 0; ; ++attempt) {
+        searchCursor cursor(this, search_base, scope, filter, attributes, sparams);
+
+        searchResultSet *search_result = new searchResultSet(names);
+        try {
+            while (cursor.fetch(*search_result));
+        } catch (SearchException &ex) {
+            delete search_result;
+            // session was lost after the first page, search starts over in a new one
+            if (cursor.started && retryRead(ex.code, attempt)) continue;
+            throw;
+        } catch (...) {
+            delete search_result;
+            throw;
+        }
+        return search_result;
+    }
+}
+
 void client::modify(string dn, int mod_op, string attribute, vector <string> list) {
 /*
   It performs an object modification operation (short_name/DN).
   It removes list from attribute.
   It returns nothing if operation was successfull, throw OperationalException - otherwise.
 */
-    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
-
-    LDAPMod *attrs[2];
-    LDAPMod attr;
-    int result;
-    string error_msg;
-    char** values = new char*[list.size() + 1];
-    size_t i;
+    std::vector <clientModification> mods;
+    mods.push_back(clientModification(mod_op, attribute, list));
 
-    for (i = 0; i < list.size(); ++i) {
-        values[i] = new char[list[i].size() + 1];
-        strcpy(values[i], list[i].c_str());
-    }
-    values[i] = NULL;
+    modify(dn, mods);
+}
 
-    attr.mod_op = mod_op;
-    attr.mod_type = strdup(attribute.c_str());
-    attr.mod_values = values;
+void client::modify(string dn, const std::vector <clientModification> &mods) {
+/*
+  It performs all modifications of an object (short_name/DN) in a single modify request,
+  so they are applied atomically by server in the given order.
+  It returns nothing if operation was successfull, throw OperationalException - otherwise.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+    if (mods.empty()) return;
 
-    attrs[0] = &attr;
-    attrs[1] = NULL;
+    LDAPModList attrs(mods);
 
-    result = ldap_modify_ext_s(ds, dn.c_str(), attrs, NULL, NULL);
+    int result = ldap_modify_ext_s(ds, dn.c_str(), attrs.get(), NULL, NULL);
+    observe(result);
     if (result != LDAP_SUCCESS) {
-        error_msg = "Error in modify '" + dn + "', ldap_modify_ext_s: ";
+        string error_msg = "Error in modify '" + dn + "', ldap_modify_ext_s: ";
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
-    for (i = 0; i < list.size(); ++i) {
-        delete[] values[i];
-    }
-    delete[] values;
-    free(attr.mod_type);
+    invalidate(dn, false);
 }
 
 void client::modifyDN(string dn, string newrdn, string newparent, int deleteoldrdn) {
@@ -481,6 +1095,7 @@ void client::modifyDN(string dn, string newrdn, string newparent, int deleteoldr
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg,result);
     }
+    invalidateRenamed(dn, newrdn, newparent);
 }
 
 void client::mod_add(string dn, string attribute, string value) {
@@ -515,6 +1130,7 @@ void client::mod_add(string dn, string attribute, string value) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
+    invalidate(dn, false);
 }
 
 void client::mod_delete(string dn, string attribute, string value) {
@@ -555,6 +1171,7 @@ void client::mod_delete(string dn, string attribute, string value) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
+    invalidate(dn, false);
 }
 
 void client::mod_move(string dn, string new_container) {
@@ -575,6 +1192,7 @@ void client::mod_move(string dn, string new_container) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
+    invalidateRenamed(dn, newrdn, new_container);
 }
 
 void client::mod_rename(string dn, string cn) {
@@ -588,6 +1206,7 @@ void client::mod_rename(string dn, string cn) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg,result);
     }
+    invalidateRenamed(dn, newrdn, "");
 }
 
 void client::mod_replace(string dn, string attribute, vector <string> list) {
@@ -624,6 +1243,7 @@ void client::mod_replace(string dn, string attribute, vector <string> list) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
+    invalidate(dn, false);
     for (i = 0; i < list.size(); ++i) {
         delete[] values[i];
     }
@@ -656,6 +1276,7 @@ void client::DeleteDN(string dn) {
         error_msg.append(ldap_err2string(result));
         throw OperationalException(error_msg, result);
     }
+    invalidate(dn, false);
 }
 
 string client::dn2domain(string dn) {
@@ -764,6 +1385,14 @@ vector <string> client::getObjectAttribute(string object, string attribute) {
     vector <string> attributes;
     attributes.push_back(attribute);
 
+    int code;
+    string msg;
+    string selector = entryCache::selector(attributes);
+    if (missing && missing->get(object, selector, code, msg)) {
+        throw SearchException(msg, code);
+    }
+
+    uint64_t missing_generation = missing ? missing->generation(object) : 0;
     map < string, vector<string> > attrs;
     attrs = getObjectAttributes(object, attributes);
 
@@ -771,7 +1400,11 @@ vector <string> client::getObjectAttribute(string object, string attribute) {
         return attrs.at(attribute);
     }
     catch (const std::out_of_range&) {
-        throw SearchException("No such attribute '" + attribute + "' in '" + object + "'", ATTRIBUTE_ENTRY_NOT_FOUND);
+        msg = "No such attribute '" + attribute + "' in '" + object + "'";
+        if (missing) {
+            missing->put(object, selector, ATTRIBUTE_ENTRY_NOT_FOUND, msg, missing_generation);
+        }
+        throw SearchException(msg, ATTRIBUTE_ENTRY_NOT_FOUND);
     }
 }
 
@@ -788,13 +1421,42 @@ map <string, vector <string> > client::getObjectAttributes(string dn, const vect
 /*
   It returns map of given object attributes.
 */
+    map < string, vector<string> > attrs;
+
+    string selector = entryCache::selector(attributes);
+    if (cache && cache->get(dn, selector, attrs)) {
+        return attrs;
+    }
+    // missing object fails the same way for any attributes
+    int code;
+    string msg;
+    if (missing && missing->get(dn, "", code, msg)) {
+        throw SearchException(msg, code);
+    }
+
     map < string, map < string, vector<string> > > search_result;
+    uint64_t generation = cache ? cache->generation(dn) : 0;
+    uint64_t missing_generation = missing ? missing->generation(dn) : 0;
 
-    search_result = search(dn, LDAP_SCOPE_BASE, "(objectclass=*)", attributes);
+    // cached objects are known by objectGUID too, see entryCache::findGUID
+    vector <string> requested = attributes;
+    bool guid_added = cache && entryCache::requestGUID(requested);
+
+    try {
+        search_result = search(dn, LDAP_SCOPE_BASE, "(objectclass=*)", requested);
+    } catch (SearchException &ex) {
+        if (missing && negativeCache::missing(ex.code)) {
+            missing->put(dn, "", ex.code, ex.msg, missing_generation);
+        }
+        throw;
+    }
 
-    map < string, vector<string> > attrs;
     try {
         attrs = search_result.at(dn);
+        if (cache) {
+            string guid = entryCache::takeGUID(attrs, guid_added);
+            cache->put(dn, selector, attrs, generation, guid);
+        }
     }
     catch (const std::out_of_range&) {
         attrs = map < string, vector<string> >();
@@ -846,7 +1508,8 @@ AD can set following limit (http://support.microsoft.com/kb/315071/en-us):
 OpenLDAP does not support ranged controls for values:
   https://www.mail-archive.com/openldap-its@openldap.org/msg00962.html
 
-So the only way is it increase MaxValRange in DC:
+_resolveranges fetches remaining ranges itself (see range.cpp), up to max_range_values
+of connection params, openAttribute streams them. Other way is to increase MaxValRange in DC:
  Ntdsutil.exe
    LDAP policies
      connections
@@ -894,134 +1557,65 @@ map < string, vector<string> > client::_getvalues(LDAPMessage *entry) {
     return result;
 }
 
+void client::_appendentry(LDAPMessage *entry, searchResultSet &into) {
+/*
+  It appends entry with all its attributes and values to 'into', without intermediate copies.
+  Ranged attributes keep their names, see _resolveranges.
+*/
+    if ((ds == NULL) || (entry == NULL)) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
 
-vector <string> client::DNsToShortNames(vector <string> &v) {
-    vector <string> result;
-
-    vector <string>::iterator it;
-    for (it = v.begin(); it != v.end(); ++it) {
-        vector <string> short_v;
-        try {
-            short_v = getObjectAttribute(*it, "sAMAccountName");
-        }
-        catch (SearchException& ex) {
-            if (ex.code == ATTRIBUTE_ENTRY_NOT_FOUND ||
-                // object could be not found if it is in a different search base / domain
-                ex.code == OBJECT_NOT_FOUND) {
-                result.push_back(*it);
-                continue;
-            }
-            throw;
-        }
-        result.push_back(short_v[0]);
-    }
-    return result;
-}
-
-string client::domain2dn(string domain) {
-    replace(domain, ".", ",DC=");
-    return "DC=" + domain;
-}
-
-vector<string> client::get_ldap_servers(string domain, string site) {
-    vector<string> servers;
-    if (!site.empty()) {
-        string srv_site = "_ldap._tcp." + site + "._sites." + domain;
-        try {
-            servers = perform_srv_query(srv_site);
-        } catch (BindException &ex) { }
+    char *dn = ldap_get_dn(ds, entry);
+    if (dn == NULL) {
+        throw SearchException("Error in ldap_get_dn for _appendentry", ATTRIBUTE_ENTRY_NOT_FOUND);
     }
+    into.addEntry(dn);
+    ldap_memfree(dn);
 
-    string srv_default = "_ldap._tcp." + domain;
-    vector<string> servers_default = perform_srv_query(srv_default);
+    BerElement *berptr;
 
-    // extend site DCs list with all DCs list (except already added site DCs) in case when site DCs is unavailable
-    for (vector <string>::iterator it = servers_default.begin(); it != servers_default.end(); ++it) {
-        if (find(servers.begin(), servers.end(), *it) == servers.end()) {
-            servers.push_back(*it);
+    for ( char *next = ldap_first_attribute(ds, entry, &berptr);
+          next != NULL;
+          next = ldap_next_attribute(ds, entry, berptr) ) {
+        struct berval **values = ldap_get_values_len(ds, entry, next);
+        if (values == NULL) {
+            ldap_memfree(next);
+            ber_free(berptr, 0);
+            string error = "Error in ldap_get_values_len for _appendentry: no values found";
+            throw SearchException(error, ATTRIBUTE_ENTRY_NOT_FOUND);
         }
+        into.addAttribute(next);
+        for (unsigned int i = 0; values[i] != NULL; ++i) {
+            into.addValue(std::string_view(values[i]->bv_val, values[i]->bv_len));
+        }
+        ldap_memfree(next);
+        ldap_value_free_len(values);
     }
 
-    return servers;
+    ber_free(berptr, 0);
 }
 
 
+vector <string> client::DNsToShortNames(vector <string> &v) {
+/*
+  It returns sAMAccountName of each DN, or the DN itself if it has none or is not found
+  (it could be in a different search base / domain).
+*/
+    map <string, vector <string> > names = resolveAttribute(v, "sAMAccountName");
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunknown-pragmas"
-#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
-// this magic was copy pasted and adopted from
-// https://www.ccnx.org/releases/latest/doc/ccode/html/ccndc-srv_8c_source.html
-vector<string> client::perform_srv_query(string srv_rec) {
-    union dns_ans {
-             HEADER header;
-             unsigned char buf[NS_MAXMSG];
-          } ans;
-    size_t ans_size;
-
-    char *srv_name = strdup(srv_rec.c_str());
-    if (!srv_name) {
-        throw BindException("Failed to allocate memory for srv_rec", LDAP_RESOLV_ERROR);
-    }
-    ans_size = res_search(srv_name, ns_c_in, ns_t_srv, ans.buf, sizeof(ans.buf));
-
-    int qdcount, ancount;
-    qdcount = ntohs(ans.header.qdcount);
-    ancount = ntohs(ans.header.ancount);
-
-    unsigned char *msg, *msgend;
-    msg = ans.buf + sizeof(ans.header);
-    msgend = ans.buf + ans_size;
-
-    int size = 0, i;
-    for (i = qdcount; i > 0; --i) {
-        if ((size = dn_skipname(msg, msgend)) < 0) {
-            free(srv_name);
-            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_skipname < 0", LDAP_RESOLV_ERROR);
+    vector <string> result;
+    for (vector <string>::iterator it = v.begin(); it != v.end(); ++it) {
+        map <string, vector <string> >::iterator found = names.find(*it);
+        if (found == names.end() || found->second.empty()) {
+            result.push_back(*it);
+        } else {
+            result.push_back(found->second[0]);
         }
-        msg = msg + size + QFIXEDSZ;
     }
+    return result;
+}
 
-    int type = 0, priority = 0, weight = 0, port = 0, recclass = 0, ttl = 0;
-    unsigned char *end;
-    char host[NS_MAXDNAME];
-
-    vector<string> ret;
-    for (i = ancount; i > 0; --i) {
-        size = dn_expand(ans.buf, msgend, msg, srv_name, strlen(srv_name)+1);
-        if (size < 0) {
-            free(srv_name);
-            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_expand(srv_name) < 0", LDAP_RESOLV_ERROR);
-        }
-        msg = msg + size;
-
-        GETSHORT(type, msg);
-        GETSHORT(recclass, msg);
-        GETLONG(ttl, msg);
-        GETSHORT(size, msg);
-        if ((end = msg + size) > msgend) {
-            free(srv_name);
-            throw BindException("Error while resolving ldap server for " + srv_rec + ": (msg + size) > msgend", LDAP_RESOLV_ERROR);
-        }
-
-        if (type != ns_t_srv) {
-            msg = end;
-            continue;
-        }
-
-        GETSHORT(priority, msg);
-        GETSHORT(weight, msg);
-        GETSHORT(port, msg);
-        size = dn_expand(ans.buf, msgend, msg, host, sizeof(host));
-        if (size < 0) {
-            free(srv_name);
-            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_expand(host) < 0", LDAP_RESOLV_ERROR);
-        }
-        // std::cout << priority << " " << weight << " " << ttl << " " << host << ":" << port << std::endl;
-        ret.push_back(string(host));
-        msg = end;
-    }
-    free(srv_name);
-    return ret;
+string client::domain2dn(string domain) {
+    replace(domain, ".", ",DC=");
+    return "DC=" + domain;
 }
-#pragma GCC diagnostic pop
+
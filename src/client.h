@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <sstream>
 #include <iostream>
 #include <iterator>     // std::distance
@@ -34,6 +35,17 @@
 #include <cstdlib>
 #include <resolv.h>
 #include <unistd.h>
+#include <future>
+#include <chrono>
+#include <string_view>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <stdint.h>
 
 // for OS X
 #ifndef NS_MAXMSG
@@ -52,6 +64,14 @@
 
 #define MAX_PASSWORD_LENGTH 22
 
+// connect_stagger_ms value to try uries one by one
+#define CONNECT_SEQUENTIAL 0
+
+// paged results control page size values
+#define PAGESIZE_DEFAULT            0   // use clientConnParams::pagesize
+#define PAGESIZE_ADAPTIVE          -1   // grow/shrink page from observed entry sizes
+#define ADAPTIVE_INITIAL_PAGESIZE 100
+
 #define SCOPE_BASE         LDAP_SCOPE_BASE
 #define SCOPE_BASEOBJECT   LDAP_SCOPE_BASEOBJECT
 #define SCOPE_ONELEVEL     LDAP_SCOPE_ONELEVEL
@@ -121,6 +141,31 @@ public:
     int nettimeout;
     // LDAP_OPT_TIMELIMIT
     int timelimit;
+    // rootDSE probe timeout (ms) of all uries before bind, 0 to bind without probing.
+    // Probe goes over CLDAP (UDP) if uri scheme is cldap://
+    int probe_timeout_ms;
+    // CONNECT_SEQUENTIAL to try uries one by one, otherwise delay (ms) between
+    // starts of parallel connection attempts, the first bound one is kept
+    int connect_stagger_ms;
+    // times a read (search) is sent again after reconnect, when the session was lost, 0 to never retry
+    int read_retries;
+    // TCP keepalive of the connection (seconds idle before probes, number of probes, seconds between probes),
+    // 0 to keep system defaults
+    int keepalive_idle;
+    int keepalive_probes;
+    int keepalive_interval;
+
+    // paged results control page size, PAGESIZE_ADAPTIVE for adaptive mode
+    int pagesize;
+    // adaptive mode never asks for more than server's MaxPageSize (AD default is 1000)
+    int max_pagesize;
+    // adaptive mode keeps estimated size of a single page below this budget (bytes)
+    long page_memory_budget;
+    // values kept of attribute, that server returns in ranges ("member;range=0-1499", AD MaxValRange),
+    // remaining ranges are fetched up to this total, 0 for all values. The first range is always kept
+    long max_range_values;
+    // base searches in flight at once in bulk lookups (getObjectsAttributes, resolveAttribute, exists)
+    int lookup_window;
 
     string krb5_keytab_name;
     string krb5_ccache_name;
@@ -132,7 +177,18 @@ public:
         use_ldaps(false),
         // by default do not touch timeouts
         nettimeout(-1),
-        timelimit(-1) {
+        timelimit(-1),
+        probe_timeout_ms(0),
+        connect_stagger_ms(CONNECT_SEQUENTIAL),
+        read_retries(1),
+        keepalive_idle(0),
+        keepalive_probes(0),
+        keepalive_interval(0),
+        pagesize(500),
+        max_pagesize(1000),
+        page_memory_budget(16 * 1024 * 1024),
+        max_range_values(0),
+        lookup_window(64) {
 
         char *ccache_name = NULL;
 
@@ -155,6 +211,339 @@ private:
     string bind_method;
 };
 
+struct clientSearchParams {
+public:
+    // PAGESIZE_DEFAULT to use connection page size, PAGESIZE_ADAPTIVE for adaptive mode
+    int pagesize;
+    // return deleted objects (tombstones) too, with Active Directory show deleted control
+    bool show_deleted;
+    // server-side sort keys (RFC 2891), e.g. "sn -whenCreated" ('-' for reverse order), empty for server order
+    string sort;
+    // virtual list view window: vlv_before entries before and vlv_after entries after the target
+    // at vlv_offset (1-based) of vlv_content_count (0 if unknown) sorted entries.
+    // VLV needs sort and replaces paging, it is disabled if vlv_offset is 0
+    int vlv_offset;
+    int vlv_before;
+    int vlv_after;
+    int vlv_content_count;
+
+    clientSearchParams() :
+        pagesize(PAGESIZE_DEFAULT), show_deleted(false),
+        vlv_offset(0), vlv_before(0), vlv_after(0), vlv_content_count(0) {};
+};
+
+struct clientModification {
+public:
+    // LDAP_MOD_ADD, LDAP_MOD_DELETE or LDAP_MOD_REPLACE
+    int mod_op;
+    string attribute;
+    std::vector <string> values;
+
+    clientModification() :
+        mod_op(LDAP_MOD_REPLACE) {};
+    clientModification(int _mod_op, string _attribute, std::vector <string> _values) :
+        mod_op(_mod_op), attribute(_attribute), values(_values) {};
+};
+
+#ifndef SWIG
+/*
+  attributeNames interns attribute names of all connections, so each name is stored once
+  and compared by id. Well-known AD/RFC 4519 names have fixed ids. The table is process-wide,
+  so ids are sent to Go with serialized result sets, and Go does not keep its own list.
+  Names are case-sensitive here, as the server returns them with schema case.
+  Names with options are not interned (see searchResultSet::setName), so the table stays bounded.
+*/
+class attributeNames {
+public:
+    // the process-wide table
+    static std::shared_ptr <attributeNames> shared();
+
+    uint32_t intern(std::string_view name);
+    // view stays valid as long as the table exists
+    std::string_view name(uint32_t id) const;
+
+private:
+    mutable std::mutex mutex;
+    // names, that are not well-known, id is wellKnownCount + index
+    std::deque <string> names;
+    std::unordered_map <std::string_view, uint32_t> ids;
+};
+#endif
+
+/*
+  searchResultSet keeps found entries in one contiguous arena: DNs, attribute names
+  and values are appended to it as they are received, and located by offset tables.
+  Entries and attributes keep server order, accessors return views into the arena,
+  that are valid until the set is modified or destroyed.
+  Attribute names are interned in the process-wide names table.
+*/
+class searchResultSet {
+public:
+    searchResultSet();
+#ifndef SWIG
+    searchResultSet(std::shared_ptr <attributeNames> _names);
+#endif
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    // total size of DNs, attribute names and values
+    size_t bytes() const { return arena.size(); }
+    void clear();
+
+    // position of the target entry and server's estimate of sorted entries count,
+    // returned by virtual list view search, 0 otherwise
+    long vlvTargetPosition() const { return vlv_target_position; }
+    long vlvContentCount() const { return vlv_content_count; }
+#ifndef SWIG
+    void setVlvResult(long target_position, long content_count) { vlv_target_position = target_position; vlv_content_count = content_count; }
+#endif
+
+    size_t attributeCount(size_t entry) const { return entries.at(entry).attr_count; }
+    size_t valueCount(size_t entry, size_t attr) const { return attribute(entry, attr).value_count; }
+#ifndef SWIG
+    std::string_view dn(size_t entry) const { return view(entries.at(entry).dn); }
+    std::string_view attributeName(size_t entry, size_t attr) const { return attributeName(attribute(entry, attr)); }
+    std::string_view value(size_t entry, size_t attr, size_t value) const;
+    // index of attribute of entry, or -1 if entry has no such attribute
+    long findAttribute(size_t entry, std::string_view name) const;
+
+    void addEntry(std::string_view dn);
+    void addAttribute(std::string_view name);
+    void addValue(std::string_view value);
+    // it renames the last attribute
+    void renameAttribute(std::string_view name);
+    // it drops entries from 'count' on
+    void truncate(size_t count);
+    void append(const searchResultSet &other);
+#endif
+
+    // true if an attribute holds only the first range of its values, see range.cpp
+    bool ranged() const { return firstRanged(0) < size(); }
+#ifndef SWIG
+    // index of the first entry from 'from' on with such attribute, size() if none
+    size_t firstRanged(size_t from) const;
+#endif
+
+    std::map <string, std::map <string, std::vector <string> > > toMap() const;
+    // whole set in one caller-owned buffer of serializedSize() bytes, see resultset.cpp for the layout
+    size_t serializedSize() const;
+    void serialize(char *buf, size_t size) const;
+
+private:
+    struct span {
+        size_t offset;
+        size_t length;
+    };
+    struct entryIndex {
+        span dn;
+        size_t first_attr;
+        size_t attr_count;
+    };
+    struct attributeIndex {
+        // LOCAL_NAME if the name is kept in the arena
+        uint32_t name_id;
+        span name;
+        size_t first_value;
+        size_t value_count;
+    };
+    static const uint32_t LOCAL_NAME = UINT32_MAX;
+
+    span store(std::string_view data);
+    size_t usedNames(std::unordered_map <std::string_view, uint32_t> &name_index, std::vector <std::string_view> &used_names, std::vector <uint32_t> &used_ids) const;
+    std::string_view view(const span &s) const { return std::string_view(arena.data() + s.offset, s.length); }
+    const attributeIndex &attribute(size_t entry, size_t attr) const;
+    void setName(attributeIndex &a, std::string_view name);
+    std::string_view attributeName(const attributeIndex &a) const;
+
+    std::shared_ptr <attributeNames> names;
+    string arena;
+    std::vector <entryIndex> entries;
+    std::vector <attributeIndex> attributes;
+    std::vector <span> values;
+
+    long vlv_target_position;
+    long vlv_content_count;
+};
+
+// number of independently locked parts of entry cache
+#define ENTRY_CACHE_SHARDS 16
+
+/*
+  entryCache is a memory-bounded LRU cache of base lookups (getObjectAttributes, ifDNExists),
+  keyed by normalized DN and requested attributes, entries expire after ttl seconds.
+  Copies share the same cache, so all clients of a connection could use one.
+  Changes made through clients of the cache invalidate affected DNs, other changes
+  (by other connections, or back-links like memberOf) are seen after ttl at most.
+*/
+class entryCache {
+public:
+    entryCache(long max_bytes, int ttl);
+
+    long hits();
+    long misses();
+    long evictions();
+    // number of cached lookups and their estimated memory size
+    long size();
+    long bytes();
+
+    void clear();
+    // it drops cached lookups of dn, and of all DNs under it if subtree is true
+    void invalidate(string dn, bool subtree = false);
+
+#ifndef SWIG
+    bool get(const string &dn, const string &selector, std::map <string, std::vector<string> > &attrs);
+    // normalized DN of cached object with objectGUID, empty if there is none
+    string findGUID(const string &guid);
+    // generation is taken before the lookup is sent, lookup is not stored if dn has been invalidated since
+    uint64_t generation(const string &dn);
+    void put(const string &dn, const string &selector, const std::map <string, std::vector<string> > &attrs, uint64_t generation, const string &guid = "");
+
+    // it returns DN in the form used as cache key: lower case, without spaces around separators
+    static string normalize(const string &dn);
+    // it returns cache key part of requested attributes
+    static string selector(const std::vector <string> &attributes);
+    // lookups ask for objectGUID of cached objects, it returns true if it was not requested
+    static bool requestGUID(std::vector <string> &attributes);
+    // it returns objectGUID of lookup, and removes it from attrs if it was added by requestGUID
+    static string takeGUID(std::map <string, std::vector<string> > &attrs, bool added);
+
+    struct state;
+private:
+    std::shared_ptr <state> shared;
+#endif
+};
+
+/*
+  negativeCache remembers lookups, that have failed because object or attribute is missing
+  (OBJECT_NOT_FOUND, LDAP_NO_SUCH_OBJECT, ATTRIBUTE_ENTRY_NOT_FOUND), for a short ttl,
+  so repeated lookups of missing objects are answered locally with the same error.
+  It is bounded by number of lookups, the least recently used are dropped.
+  Copies share the same cache, it is kept apart from entryCache.
+*/
+class negativeCache {
+public:
+    negativeCache(long max_entries, int ttl);
+
+    long hits();
+    long misses();
+    long size();
+
+    void clear();
+    // it drops failed lookups of dn, and of all DNs under it if subtree is true
+    void invalidate(string dn, bool subtree = false);
+
+#ifndef SWIG
+    // it returns true and sets code and msg, if lookup of dn is known to fail
+    bool get(const string &dn, const string &selector, int &code, string &msg);
+    // generation is taken before the lookup is sent, failure is not stored if dn has been invalidated since
+    uint64_t generation(const string &dn);
+    void put(const string &dn, const string &selector, int code, const string &msg, uint64_t generation);
+
+    // true if code means a missing object or attribute
+    static bool missing(int code);
+
+    struct state;
+private:
+    std::shared_ptr <state> shared;
+#endif
+};
+
+struct asyncResult {
+public:
+    int msgid;
+    // LDAP result code of the operation
+    int code;
+    string error_msg;
+    // found entries, for search operations only
+    searchResultSet entries;
+
+    asyncResult() :
+        msgid(-1),
+        code(LDAP_SUCCESS) {};
+};
+
+// ldap_result poll interval of async dispatcher, when nothing has been received
+#define ASYNC_POLL_TIMEOUT_MS 100
+
+struct asyncState;
+struct bindRace;
+
+struct srvRecord {
+public:
+    string host;
+    int port;
+    int priority;
+    int weight;
+    // seconds, as returned by DNS server
+    int ttl;
+
+    srvRecord() :
+        port(0), priority(0), weight(0), ttl(0) {};
+};
+
+// weight of the newest sample in DC scoreboard averages
+#define SCOREBOARD_EWMA_ALPHA 0.2
+// consecutive failures, that open DC circuit breaker
+#define SCOREBOARD_BREAKER_FAILURES 3
+// seconds DC is skipped after circuit breaker opens, then a single trial is allowed
+#define SCOREBOARD_BREAKER_COOLDOWN 30
+// seconds a trial is given to one caller, before another caller could take it
+#define SCOREBOARD_TRIAL_TIMEOUT 10
+// RTT EWMA is weighted by (1 + error rate * SCOREBOARD_ERROR_PENALTY)
+#define SCOREBOARD_ERROR_PENALTY 10
+
+struct dcStats {
+public:
+    // EWMA of round trip time of probes, binds and cheap base operations, milliseconds
+    double rtt_ms;
+    long rtt_samples;
+    // EWMA of failures (1) and successes (0) of all operations
+    double error_rate;
+    long samples;
+    int consecutive_failures;
+    // circuit breaker is open until this time
+    time_t open_until;
+    // trial of half-open circuit breaker is taken until this time
+    time_t trial_until;
+    string site;
+
+    dcStats() :
+        rtt_ms(0), rtt_samples(0), error_rate(0), samples(0), consecutive_failures(0), open_until(0), trial_until(0) {};
+};
+
+/*
+  dcScoreboard is process-wide health and latency record of domain controllers,
+  keyed by host[:port]. It is fed by bind and operations of all clients, and by probes.
+*/
+class dcScoreboard {
+public:
+    static dcScoreboard &instance();
+
+    // rtt_ms is negative for operations, that are not latency samples (pages, writes, sync cycles)
+    void success(string server, double rtt_ms);
+    void failure(string server);
+    void setSite(string server, string site);
+    dcStats stats(string server);
+    void reset();
+
+    // true unless circuit breaker of server is open, the trial of half-open breaker is taken by the caller
+    bool available(string server);
+    // servers ordered by preference: available ones first, then ones of site, then by score
+    std::vector<string> rank(const std::vector<string> &servers, string site);
+
+    // it returns server of uri, used as scoreboard key
+    static string key(string uri);
+    // true if LDAP result code means server is down or overloaded
+    static bool serverFailure(int result);
+
+private:
+    std::mutex mutex;
+    std::map <string, dcStats> servers;
+};
+
+// seconds to remember failed SRV lookups, so reconnect storms do not turn into DNS storms
+#define SRV_NEGATIVE_TTL 30
+
 class clientLogger {
 public:
     virtual ~clientLogger() { }
@@ -164,12 +553,83 @@ public:
 
 extern clientLogger *log;
 
+class client;
+
+class searchCursor {
+public:
+    ~searchCursor();
+
+    bool next();
+    const searchResultSet &page() { return current; }
+    void close();
+
+    friend class client;
+private:
+    searchCursor(client *_owner, string _search_base, int _scope, string _filter, const std::vector <string> &attributes, const clientSearchParams &sparams);
+
+    bool fetch(searchResultSet &into);
+
+    client *owner;
+
+    string search_base;
+    int scope;
+    string filter;
+    char **attrs;
+
+    ber_int_t pagesize;
+    bool adaptive;
+    // show deleted, sort and VLV params of the search
+    clientSearchParams search_params;
+    struct berval *cookie;
+    bool started;
+    bool done;
+
+    searchResultSet current;
+};
+
+/*
+  attributeCursor fetches values of a single attribute range by range (see
+  clientConnParams::max_range_values), so they are never held in memory all at once.
+*/
+class attributeCursor {
+public:
+    bool next();
+    const std::vector <string> &values() { return current; }
+
+    friend class client;
+private:
+    attributeCursor(client *_owner, string _dn, string _attribute);
+
+    client *owner;
+    string dn;
+    string attribute;
+    // first index of the next range, 0 before the first fetch
+    long next_start;
+    bool done;
+
+    std::vector <string> current;
+};
+
+// result of a single base lookup of bulk lookups (getObjectsAttributes)
+struct lookupResult {
+public:
+    // LDAP_SUCCESS, or code of the failed lookup
+    int code;
+    string error_msg;
+    std::map <string, std::vector <string> > attributes;
+
+    lookupResult() : code(LDAP_SUCCESS) {}
+};
+
 class client {
 public:
     client();
     ~client();
 
     static std::vector<string> get_ldap_servers(string domain, string site = "");
+    static bool probe(string uri, int timeout_ms);
+    static void probe(const std::vector<string> &uries, int timeout_ms);
+    static void flush_srv_cache();
     static string domain2dn(string domain);
 
     void bind(clientConnParams _params);
@@ -181,7 +641,17 @@ public:
     string bind_method() { return params.bind_method; }
     string login_method() { return params.login_method; }
 
+    bool ping();
+
+    // it makes getObjectAttributes and ifDNExists use cache, shared with other clients
+    void setEntryCache(const entryCache &_cache);
+    // it makes lookups of missing objects and attributes fail from cache, shared with other clients
+    void setNegativeCache(const negativeCache &_missing);
+    // bind again with params of the last bind, the server that dropped the session is tried last
+    void reconnect();
+
     void modify(string dn, int mod_op, string attribute, vector <string> list);
+    void modify(string dn, const std::vector <clientModification> &mods);
     void modifyDN(string dn, string newrdn, string newparent, int deleteoldrdn);
 
     void DeleteDN(string dn);
@@ -194,26 +664,90 @@ public:
 
     bool            ifDNExists(string object, string objectclass);
     bool            ifDNExists(string object);
+    // existence of many objects with pipelined base lookups
+    std::map <string, bool> exists(const std::vector <string> &objects);
 
     std::vector <string> getObjectAttribute(string object, string attribute);
+    // values of attribute of each object, objects without it (or missing ones) are left out
+    std::map <string, std::vector <string> > resolveAttribute(const std::vector <string> &objects, string attribute);
 
     std::vector <string> searchDN(string search_base, string filter, int scope);
     std::vector <string> search(string search_base, string filter, int scope, const std::vector <string> &attributes);
+    std::map <string, std::map <string, std::vector <string> > > searchEntries(string search_base, string filter, int scope, const std::vector <string> &attributes);
+    std::map <string, std::map <string, std::vector <string> > > searchEntries(string search_base, string filter, int scope, const std::vector <string> &attributes, const clientSearchParams &sparams);
+    searchResultSet *searchResults(string search_base, string filter, int scope, const std::vector <string> &attributes);
+    searchResultSet *searchResults(string search_base, string filter, int scope, const std::vector <string> &attributes, const clientSearchParams &sparams);
+
+    searchCursor *openSearch(string search_base, string filter, int scope, const std::vector <string> &attributes);
+    searchCursor *openSearch(string search_base, string filter, int scope, const std::vector <string> &attributes, const clientSearchParams &sparams);
+
+    // values of attribute of object, range by range, caller owns the cursor
+    attributeCursor *openAttribute(string object, string attribute);
 
     std::map <string, std::vector <string> > getObjectAttributes(string object);
     std::map <string, std::vector <string> > getObjectAttributes(string object, const std::vector<string> &attributes);
+    // attributes of many objects with pipelined base lookups, each object has its own result
+    std::map <string, lookupResult> getObjectsAttributes(const std::vector <string> &objects, const std::vector <string> &attributes);
+
+    int asyncSearch(string search_base, string filter, int scope, const std::vector <string> &attributes);
+    int asyncModify(string dn, int mod_op, string attribute, vector <string> list);
+    int asyncModify(string dn, const std::vector <clientModification> &mods);
+    int asyncModifyDN(string dn, string newrdn, string newparent, int deleteoldrdn);
+    int asyncDeleteDN(string dn);
+
+    // ranged attributes of its entries are left as received, see asyncResolve
+    asyncResult asyncWait(int msgid);
+    // it fetches remaining ranges of ranged attributes of result, client must not be used by others meanwhile
+    void asyncResolve(asyncResult &result);
+    bool asyncReady(int msgid);
+    void asyncAbandon(int msgid);
+#ifndef SWIG
+    std::shared_future<asyncResult> asyncFuture(int msgid);
+#endif
 
-    void delLogger() { delete log; log = 0; }
-    void setLogger(clientLogger *fn) { delLogger(); log = fn; }
+    // logger is process-wide, it is shared by all clients, replaced loggers are kept alive
+    void delLogger();
+    void setLogger(clientLogger *fn);
+
+    friend class searchCursor;
+    friend class attributeCursor;
+    friend class directorySync;
+    friend class changeListener;
 private:
     clientConnParams params;
 
     LDAP *ds;
 
-    void bind(LDAP **ds, clientConnParams& _params);
-    void close(LDAP *ds);
+    // dispatcher of requests in flight, NULL until the first async request of a session
+    std::shared_ptr <asyncState> async;
+    // results of async requests, that are not claimed yet, async_mutex guards them and async
+    std::map <int, std::shared_future<asyncResult> > async_futures;
+    std::mutex async_mutex;
+    // attribute names of entries found with this client, attributeNames::shared()
+    std::shared_ptr <attributeNames> names;
+    // cache of base lookups, NULL if disabled
+    std::unique_ptr <entryCache> cache;
+    // cache of failed base lookups, NULL if disabled
+    std::unique_ptr <negativeCache> missing;
+
+    void invalidate(string dn, bool subtree);
+    void invalidateRenamed(string dn, string newrdn, string newparent);
+    void invalidateChanged(string dn, string guid);
+    void connect(clientConnParams _params, string dropped_uri);
+    void bindParallel(clientConnParams &_params);
+    void observe(double started_ms, int result);
+    void observe(int result);
+    bool retryRead(int result, int attempt);
+    std::map <string, std::vector <string> > rootDSE(const std::vector <string> &attributes);
+    std::map <string, lookupResult> bulkLookup(const std::vector <string> &objects, const std::vector <string> &attributes, const string &selector);
+    static void bindAttempt(std::shared_ptr<bindRace> race, size_t index, clientConnParams _params, int stagger_ms);
+    static void bind(LDAP **ds, clientConnParams& _params);
+    static void close(LDAP *ds);
 
     std::map < string, std::map < string, std::vector<string> > > search(string search_base, int scope, string filter, const std::vector <string> &attributes);
+    std::map < string, std::map < string, std::vector<string> > > search(string search_base, int scope, string filter, const std::vector <string> &attributes, const clientSearchParams &sparams);
+    ber_int_t initial_pagesize(const clientSearchParams &sparams);
+    ber_int_t adaptive_pagesize(ber_int_t pagesize, size_t page_bytes, int page_entries);
 
     void mod_add(string object, string attribute, string value);
     void mod_delete(string object, string attribute, string value);
@@ -222,17 +756,205 @@ private:
     void mod_replace(string object, string attribute, vector <string> list);
     void mod_move(string object, string new_container);
     std::map < string, std::vector<string> > _getvalues(LDAPMessage *entry);
+    void _appendentry(LDAPMessage *entry, searchResultSet &into);
+    void _resolveranges(searchResultSet &into, size_t first);
+    void _appendranges(string dn, string attribute, long next_start, searchResultSet &into);
+    string _getrange(string dn, string attribute, long start, std::vector <string> &values);
     string dn2domain(string dn);
     vector < std::pair<string, string> > explode_dn(string dn);
     string merge_dn(vector < std::pair<string, string> > dn_exploded);
     std::vector <string> DNsToShortNames(std::vector <string> &v);
 
+    int asyncRegister(int msgid, int type, string dn, string newrdn = "", string newparent = "");
+    void asyncDispatch(std::shared_ptr <asyncState> state);
+    void asyncComplete(asyncState &state, int msgid, int rc, LDAPMessage *res);
+    void asyncShutdown();
+
     std::string ldap_prefix;
 
-    static std::vector<string> perform_srv_query(string srv_rec);
+    static std::vector<srvRecord> perform_srv_query(string srv_rec);
+    static std::vector<srvRecord> lookup_srv(string srv_rec);
+    static std::vector<string> order_srv(std::vector<srvRecord> records);
     static struct berval password2berval(string password);
 };
 
+// change tracking methods of directorySync
+#define SYNC_AUTO        0   // picked by controls, that server supports
+#define SYNC_DIRSYNC     1   // Active Directory DirSync control
+#define SYNC_SYNCREPL    2   // RFC 4533 content synchronization, refreshOnly
+#define SYNC_USNCHANGED  3   // uSNChanged high-water mark of one domain controller
+
+// seconds syncrepl refresh waits for the next message, if the client has no network timeout
+#define SYNC_RESULT_TIMEOUT 120
+
+struct syncParams {
+public:
+    // SYNC_AUTO, SYNC_DIRSYNC, SYNC_SYNCREPL or SYNC_USNCHANGED
+    int mode;
+    // DirSync needs the root of a naming context here
+    string search_base;
+    string filter;
+    std::vector <string> attributes;
+    // cookie is kept in this file between runs, in memory only if empty
+    string cookie_file;
+    // DirSync flags, e.g. 0x1 (object security), 0x800 (ancestors first)
+    int dirsync_flags;
+    // DirSync maximum response size, 0 for server default
+    int dirsync_max_bytes;
+
+    syncParams() :
+        mode(SYNC_AUTO), filter("(objectclass=*)"), dirsync_flags(0), dirsync_max_bytes(0) {};
+};
+
+/*
+  syncChanges are changes of one sync cycle. Entries are identified by objectGUID
+  (Active Directory) or entryUUID (syncrepl), in their 16 bytes binary form.
+*/
+class syncChanges {
+public:
+    // replica must be replaced by changed entries (first cycle, or cookie is not valid anymore)
+    bool full;
+    // added and modified entries (DirSync returns changed attributes only), and their ids
+    searchResultSet changed;
+    std::vector <string> changed_ids;
+    // deleted entries, DNs are tombstone DNs for Active Directory
+    std::vector <string> deleted;
+    std::vector <string> deleted_ids;
+    // entries of replica, that are neither changed nor present, are deleted (syncrepl present phase)
+    bool refresh_present;
+    std::vector <string> present_ids;
+
+    syncChanges() :
+        full(false), refresh_present(false) {};
+};
+
+/*
+  directorySync keeps a replica current by fetching changes since the last cycle,
+  which are tracked by an opaque cookie. Cookie of a cycle becomes current only
+  when the caller commits it, after changes have been applied, so failed cycles
+  are fetched again. Cookie is saved to cookie_file (if given) on commit.
+*/
+class directorySync {
+public:
+    directorySync(const syncParams &_params);
+
+    // changes since the last committed cycle, caller owns them
+    syncChanges *cycle(client &c);
+    void commit();
+    // forget cookie, next cycle returns full content
+    void reset();
+
+    // mode in use, SYNC_AUTO until the first cycle
+    int mode() { return current_mode; }
+
+private:
+    syncParams params;
+    int current_mode;
+    string cookie;
+    string pending_cookie;
+    bool pending;
+
+    void load();
+    void save();
+    int detect(client &c);
+    void dirsync(client &c, syncChanges &changes);
+    void syncrepl(client &c, syncChanges &changes);
+    void usnchanged(client &c, syncChanges &changes);
+};
+
+// change types of changeNotification, values of persistent search changeTypes
+#define CHANGE_ADD      1
+#define CHANGE_DELETE   2
+#define CHANGE_MODIFY   4
+#define CHANGE_MODDN    8
+#define CHANGE_ANY     15
+
+// controls of changeListener
+#define LISTEN_AUTO          0   // picked by controls, that server supports
+#define LISTEN_NOTIFICATION  1   // Active Directory LDAP_SERVER_NOTIFICATION control
+#define LISTEN_PERSISTENT    2   // persistent search (draft-ietf-ldapext-psearch)
+
+#define LDAP_CONTROL_AD_NOTIFICATION "1.2.840.113556.1.4.528"
+
+struct changeListenerParams {
+public:
+    // LISTEN_AUTO, LISTEN_NOTIFICATION or LISTEN_PERSISTENT
+    int mode;
+    string search_base;
+    int scope;
+    // Active Directory notification accepts "(objectclass=*)" only
+    string filter;
+    std::vector <string> attributes;
+    // CHANGE_* mask of persistent search, notification reports all changes
+    int change_types;
+    // seconds between attempts to listen again, after the session was lost
+    int retry_interval;
+
+    changeListenerParams() :
+        mode(LISTEN_AUTO), scope(LDAP_SCOPE_SUBTREE), filter("(objectclass=*)"), change_types(CHANGE_ANY), retry_interval(5) {};
+};
+
+class changeNotification {
+public:
+    // CHANGE_*, notification reports additions and renames as CHANGE_MODIFY
+    int type;
+    string dn;
+    // DN before CHANGE_MODDN, if server has sent it
+    string previous_dn;
+    // changed entry with requested attributes, and objectGUID with LISTEN_NOTIFICATION
+    searchResultSet entry;
+
+    changeNotification() :
+        type(CHANGE_MODIFY) {};
+};
+
+/*
+  changeHandler receives notifications of changeListener, on the listener thread.
+  missed() is called after listening has resumed, when changes could have been missed.
+*/
+class changeHandler {
+public:
+    virtual ~changeHandler() { }
+    virtual void notify(const changeNotification &) { }
+    virtual void missed(string) { }
+};
+
+/*
+  changeListener listens for changes with a long-lived search on the bound client c,
+  on its own thread, so c must not be used by anything else until the listener is stopped.
+  Cached lookups of changed objects are dropped from caches of c, which could be shared
+  with other clients. Lost session is re-established, caches are cleared then.
+*/
+class changeListener {
+public:
+    changeListener(client &c, const changeListenerParams &_params, changeHandler *_handler);
+    ~changeListener();
+
+    void start();
+    void stop();
+
+    // mode in use, LISTEN_AUTO until started
+    int mode() { return current_mode; }
+
+#ifndef SWIG
+private:
+    client &owner;
+    changeListenerParams params;
+    changeHandler *handler;
+    int current_mode;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread listener;
+    std::atomic<bool> stopping;
+
+    int detect();
+    void run();
+    void listen(bool resumed);
+    void dispatch(LDAPMessage *entry);
+#endif
+};
+
 inline string upper(string input) {
     std::transform(input.begin(), input.end(), input.begin(), ::toupper);
     return input;
@@ -276,6 +998,61 @@ inline void replace(std::string& subject, const std::string& search,
     }
 }
 
+#ifndef SWIG
+/*
+  attributeList builds NULL-terminated attribute list for ldap_search_ext(_s), NULL for all
+  user attributes. It points to strings of attributes, so they must outlive the request call.
+*/
+class attributeList {
+public:
+    attributeList(const std::vector <string> &attributes) {
+        for (size_t i = 0; i < attributes.size(); ++i) {
+            list.push_back(const_cast<char *>(attributes[i].c_str()));
+        }
+        list.push_back(NULL);
+    }
+    char **get() { return list.size() > 1 ? list.data() : NULL; }
+
+private:
+    std::vector <char *> list;
+};
+
+/*
+  LDAPModList builds NULL-terminated LDAPMod array for ldap_modify_ext(_s).
+  It points to attributes and values of mods, so mods must outlive the request call.
+*/
+class LDAPModList {
+public:
+    LDAPModList(const std::vector <clientModification> &mods) :
+        attrs(mods.size()), values(mods.size()) {
+        for (size_t i = 0; i < mods.size(); ++i) {
+            for (size_t j = 0; j < mods[i].values.size(); ++j) {
+                values[i].push_back(const_cast<char *>(mods[i].values[j].c_str()));
+            }
+            values[i].push_back(NULL);
+
+            attrs[i].mod_op = mods[i].mod_op;
+            attrs[i].mod_type = const_cast<char *>(mods[i].attribute.c_str());
+            attrs[i].mod_values = &values[i][0];
+            list.push_back(&attrs[i]);
+        }
+        list.push_back(NULL);
+    }
+
+    LDAPMod **get() { return &list[0]; }
+
+private:
+    std::vector <LDAPMod> attrs;
+    std::vector <std::vector <char *> > values;
+    std::vector <LDAPMod *> list;
+};
+#endif
+
+// monotonic clock, milliseconds
+inline double now_ms() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 inline string itos(int num) {
     std::stringstream ss;
     ss << num;
@@ -410,9 +1187,48 @@ inline string decodeSID(string sid) {
 int sasl_bind_digest_md5(LDAP *ds, string binddn, string bindpw);
 int sasl_bind_simple(LDAP *ds, string binddn, string bindpw);
 #ifdef KRB5
+// TGT is refreshed once this part of its lifetime has passed
+#define KRB5_REFRESH_RATIO 0.8
+// seconds to wait before the next attempt, when TGT refresh has failed
+#define KRB5_RETRY_INTERVAL 60
+// renewable lifetime requested for TGTs obtained from keytab, in seconds
+#define KRB5_RENEW_LIFETIME (7 * 24 * 3600)
+
+struct krb5CachedCreds;
+
+/*
+  krb5Credentials keeps credential caches of GSSAPI binds for the process lifetime,
+  one per domain, keytab and ccache name. Principal is looked up in keytab once,
+  TGT is renewed (or obtained from keytab again) in background before it expires.
+*/
+class krb5Credentials {
+public:
+    static krb5Credentials &instance();
+    ~krb5Credentials();
+
+    // it makes a valid TGT for domain available in a credential cache and sets ccache to its name,
+    // returns 0 on success
+    int acquire(const char *domain, string ccache_name, string keytab_name, const char **ccache);
+    // it destroys all credential caches, next acquire gets TGT from keytab again
+    void flush();
+
+private:
+    krb5Credentials() : stopping(false), cache_seq(0) {};
+    void renewLoop();
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread renewer;
+    bool stopping;
+    std::map <string, std::shared_ptr<krb5CachedCreds> > caches;
+    int cache_seq;
+    // names handed out by acquire, they are never freed
+    std::set <string> ccache_names;
+};
+
 int krb5_create_cache(const char *domain, krb_struct *krb_param, string ccache_name, string keytab_name);
 void krb5_cleanup(krb_struct &krb_param);
-int sasl_bind_gssapi(LDAP *ds);
+int sasl_bind_gssapi(LDAP *ds, const char *ccache);
 int sasl_rebind_gssapi(LDAP * ld, LDAP_CONST char *url, ber_tag_t request, ber_int_t msgid, void *params);
 #endif
 
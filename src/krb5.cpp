@@ -14,6 +14,7 @@
 #include <fstream>
 #include "client.h"
 #include <sstream>
+#include <atomic>
 
 using std::cout;
 using std::endl;
@@ -47,6 +48,7 @@ krb5_create_cache(const char *domain, krb_struct *krb_param, string ccache_name,
     krb5_keytab_entry entry;
     krb5_kt_cursor cursor;
     krb5_creds *creds = NULL;
+    krb5_get_init_creds_opt *opts = NULL;
     krb5_principal *principal_list = NULL;
     krb5_principal principal = NULL;
     char *service;
@@ -75,6 +77,16 @@ krb5_create_cache(const char *domain, krb_struct *krb_param, string ccache_name,
         retval = 1;
         goto cleanup;
     }
+    /*
+     * request renewable TGT, so the first refresh renews it instead of a new AS exchange
+     */
+    code = krb5_get_init_creds_opt_alloc(krb_param->context, &opts);
+    if (code) {
+        retval = 1;
+        goto cleanup;
+    }
+    krb5_get_init_creds_opt_set_renew_life(opts, KRB5_RENEW_LIFETIME);
+
     /*
      * getting default keytab name
      */
@@ -202,10 +214,8 @@ krb5_create_cache(const char *domain, krb_struct *krb_param, string ccache_name,
     ccache_name = "MEMORY:" + ccache_name;
 #endif
 
-     setenv("KRB5CCNAME", ccache_name.c_str(), 1);
-
     log_msg.str("");
-    log_msg << "Set credential cache to " << ccache_name;
+    log_msg << "Use credential cache " << ccache_name;
     log->debug(log_msg.str());
 
     code = krb5_cc_resolve(krb_param->context, ccache_name.c_str(), &krb_param->cc);
@@ -253,7 +263,7 @@ krb5_create_cache(const char *domain, krb_struct *krb_param, string ccache_name,
             }
             cout << "DEBUG: Keytab entry has principal: " << principal_name << endl;
 
-            code = krb5_get_init_creds_keytab(krb_param->context, creds, principal_list[i], keytab, 0, NULL, NULL);
+            code = krb5_get_init_creds_keytab(krb_param->context, creds, principal_list[i], keytab, 0, NULL, opts);
             if (code) {
                 const char *s = krb5_get_error_message(krb_param->context, code);
                 log_msg.str("");
@@ -353,7 +363,7 @@ loop_end:
         /*
          * get credentials
          */
-        code = krb5_get_init_creds_keytab(krb_param->context, creds, principal, keytab, 0, NULL, NULL);
+        code = krb5_get_init_creds_keytab(krb_param->context, creds, principal, keytab, 0, NULL, opts);
         if (code) {
             const char *s = krb5_get_error_message(krb_param->context, code);
             log_msg.str("");
@@ -410,9 +420,358 @@ cleanup:
 
     if (creds)
         krb5_free_creds(krb_param->context, creds);
+    if (opts)
+        krb5_get_init_creds_opt_free(krb_param->context, opts);
 
     //krb5_cleanup(krb_param);
 
     return (retval);
 
 }
+
+
+/*
+ * reusable credential caches, see krb5Credentials in client.h
+ */
+struct krb5CachedCreds {
+    // context and cache stay open, so memory cache outlives the bind
+    krb_struct krb_param;
+    krb5_principal principal;
+    string domain;
+    string keytab_name;
+    // cache name without type, unique among cached credentials
+    string requested_name;
+    // full cache name, type:residual
+    string ccache_name;
+
+    // serializes use of the context
+    std::mutex mutex;
+    time_t endtime;
+    time_t renew_till;
+    // 0 until TGT is obtained
+    std::atomic<time_t> refresh_at;
+
+    krb5CachedCreds() : principal(NULL), endtime(0), renew_till(0), refresh_at(0) {
+        krb_param.context = NULL;
+        krb_param.cc = NULL;
+    }
+
+    ~krb5CachedCreds() {
+        if (principal)
+            krb5_free_principal(krb_param.context, principal);
+        krb5_cleanup(krb_param);
+    }
+};
+
+static void
+krb5_schedule_refresh(krb5CachedCreds &creds)
+{
+    /*
+     * take the earliest expiring TGT of the cache (cross-realm one included)
+     */
+    krb5_context context = creds.krb_param.context;
+    krb5_cc_cursor cursor;
+    krb5_creds cred;
+    time_t starttime = 0;
+    std::stringstream log_msg;
+
+    creds.endtime = 0;
+    creds.renew_till = 0;
+
+    if (krb5_cc_start_seq_get(context, creds.krb_param.cc, &cursor) == 0) {
+        while (krb5_cc_next_cred(context, creds.krb_param.cc, &cursor, &cred) == 0) {
+            char *server_name = NULL;
+            if (krb5_unparse_name(context, cred.server, &server_name) == 0) {
+                if (!strncmp(server_name, "krbtgt/", strlen("krbtgt/")) && (!creds.endtime || cred.times.endtime < creds.endtime)) {
+                    starttime = cred.times.starttime ? cred.times.starttime : cred.times.authtime;
+                    creds.endtime = cred.times.endtime;
+                    creds.renew_till = cred.times.renew_till;
+                }
+                krb5_free_unparsed_name(context, server_name);
+            }
+            krb5_free_cred_contents(context, &cred);
+        }
+        krb5_cc_end_seq_get(context, creds.krb_param.cc, &cursor);
+    }
+
+    if (!creds.endtime) {
+        creds.refresh_at = time(NULL) + KRB5_RETRY_INTERVAL;
+        log->error("No TGT found in credential cache " + creds.ccache_name);
+        return;
+    }
+    creds.refresh_at = std::max(starttime + (time_t) ((creds.endtime - starttime) * KRB5_REFRESH_RATIO), time(NULL) + 1);
+
+    log_msg.str("");
+    log_msg << "TGT in " << creds.ccache_name << " expires at " << creds.endtime << ", refresh at " << creds.refresh_at;
+    log->debug(log_msg.str());
+}
+
+/*
+ * renew TGT, or get a new one from keytab with the cached principal
+ * the new TGT replaces cache content at once, so concurrent binds see either old or new one
+ */
+static int
+krb5_refresh_cache(krb5CachedCreds &creds)
+{
+    krb5_context context = creds.krb_param.context;
+    krb5_creds new_creds;
+    krb5_ccache new_cc = NULL;
+    krb5_keytab keytab = NULL;
+    krb5_get_init_creds_opt *opts = NULL;
+    krb5_error_code code = 1;
+    const char *realm;
+    int retval = 0;
+
+    std::stringstream log_msg;
+
+    if (!context || !creds.principal)
+        return (1);
+
+    memset(&new_creds, 0, sizeof(new_creds));
+
+    if (creds.renew_till > time(NULL)) {
+        code = krb5_get_renewed_creds(context, &new_creds, creds.principal, creds.krb_param.cc, NULL);
+        if (code) {
+            const char *s = krb5_get_error_message(context, code);
+            log_msg.str("");
+            log_msg << "Error while renewing TGT, get it from keytab: " << s;
+            log->debug(log_msg.str());
+        } else {
+            log->debug("Renewed TGT in " + creds.ccache_name);
+        }
+    }
+
+    if (code) {
+        memset(&new_creds, 0, sizeof(new_creds));
+        if (creds.keytab_name.empty()) {
+            code = krb5_kt_default(context, &keytab);
+        } else {
+            code = krb5_kt_resolve(context, creds.keytab_name.c_str(), &keytab);
+        }
+        if (code) {
+            const char *s = krb5_get_error_message(context, code);
+            log_msg.str("");
+            log_msg << "Error while resolving keytab " << creds.keytab_name << ": " << s;
+            log->error(log_msg.str());
+
+            retval = 1;
+            goto cleanup;
+        }
+        code = krb5_get_init_creds_opt_alloc(context, &opts);
+        if (code) {
+            retval = 1;
+            goto cleanup;
+        }
+        krb5_get_init_creds_opt_set_renew_life(opts, KRB5_RENEW_LIFETIME);
+
+        code = krb5_get_init_creds_keytab(context, &new_creds, creds.principal, keytab, 0, NULL, opts);
+        if (code) {
+            const char *s = krb5_get_error_message(context, code);
+            log_msg.str("");
+            log_msg << "Error while initialising credentials from keytab: " << s;
+            log->error(log_msg.str());
+
+            retval = 1;
+            goto cleanup;
+        }
+        log->debug("Got new TGT from keytab for " + creds.ccache_name);
+    }
+
+    code = krb5_cc_resolve(context, (creds.ccache_name + ".new").c_str(), &new_cc);
+    if (!code)
+        code = krb5_cc_initialize(context, new_cc, creds.principal);
+    if (!code)
+        code = krb5_cc_store_cred(context, new_cc, &new_creds);
+    if (code) {
+        const char *s = krb5_get_error_message(context, code);
+        log_msg.str("");
+        log_msg << "Error while storing credentials: " << s;
+        log->error(log_msg.str());
+
+        retval = 1;
+        goto cleanup;
+    }
+
+    /*
+     * principal of trusted domain needs a cross-realm TGT too
+     */
+    realm = krb5_princ_realm(context, creds.principal)->data;
+    if (strcasecmp(creds.domain.c_str(), realm)) {
+        krb5_creds tgt_request;
+        krb5_creds *tgt_creds = NULL;
+        string service = "krbtgt/" + creds.domain + "@" + realm;
+
+        memset(&tgt_request, 0, sizeof(tgt_request));
+        tgt_request.client = creds.principal;
+        code = krb5_parse_name(context, service.c_str(), &tgt_request.server);
+        if (!code) {
+            code = krb5_get_credentials(context, 0, new_cc, &tgt_request, &tgt_creds);
+            krb5_free_principal(context, tgt_request.server);
+        }
+        if (code) {
+            const char *s = krb5_get_error_message(context, code);
+            log_msg.str("");
+            log_msg << "Error while getting tgt: " << s;
+            log->error(log_msg.str());
+
+            retval = 1;
+            goto cleanup;
+        }
+        krb5_free_creds(context, tgt_creds);
+    }
+
+    code = krb5_cc_move(context, new_cc, creds.krb_param.cc);
+    if (code) {
+        const char *s = krb5_get_error_message(context, code);
+        log_msg.str("");
+        log_msg << "Error while replacing credential cache: " << s;
+        log->error(log_msg.str());
+
+        retval = 1;
+        goto cleanup;
+    }
+    // moved cache is closed
+    new_cc = NULL;
+
+    krb5_schedule_refresh(creds);
+
+cleanup:
+    if (new_cc)
+        krb5_cc_destroy(context, new_cc);
+    if (opts)
+        krb5_get_init_creds_opt_free(context, opts);
+    if (keytab)
+        krb5_kt_close(context, keytab);
+    krb5_free_cred_contents(context, &new_creds);
+
+    if (retval)
+        creds.refresh_at = time(NULL) + KRB5_RETRY_INTERVAL;
+
+    return (retval);
+}
+
+krb5Credentials &krb5Credentials::instance() {
+    static krb5Credentials credentials;
+    return credentials;
+}
+
+krb5Credentials::~krb5Credentials() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    if (renewer.joinable()) {
+        renewer.join();
+    }
+}
+
+int krb5Credentials::acquire(const char *domain, string ccache_name, string keytab_name, const char **ccache) {
+/*
+  It returns 0 if credential cache of domain holds a valid TGT, full name of the cache is set to ccache.
+  The name stays valid for the process lifetime, so it could be kept by rebind callbacks.
+  The first call per cache scans keytab and gets TGT from KDC, later calls reuse it,
+  unless refresh is due and background renewal has not happened yet.
+*/
+    std::shared_ptr<krb5CachedCreds> creds;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<krb5CachedCreds> &slot = caches[string(domain ? domain : "") + "|" + keytab_name + "|" + ccache_name];
+        if (!slot) {
+            slot = std::make_shared<krb5CachedCreds>();
+            // default cache name depends on pid only, caches of other domains or keytabs must not share it
+            slot->requested_name = ccache_name;
+            for (std::map <string, std::shared_ptr<krb5CachedCreds> >::iterator it = caches.begin(); it != caches.end(); ++it) {
+                if (it->second != slot && it->second->requested_name == ccache_name) {
+                    slot->requested_name = ccache_name + "_" + itos(++cache_seq);
+                    break;
+                }
+            }
+        }
+        creds = slot;
+
+        if (!renewer.joinable()) {
+            renewer = std::thread(&krb5Credentials::renewLoop, this);
+        }
+    }
+
+    std::lock_guard<std::mutex> creds_lock(creds->mutex);
+
+    if (!creds->krb_param.context) {
+        krb5_error_code code;
+        if (krb5_create_cache(domain, &creds->krb_param, creds->requested_name, keytab_name) != 0) {
+            krb5_cleanup(creds->krb_param);
+            creds->krb_param.context = NULL;
+            creds->krb_param.cc = NULL;
+            return 1;
+        }
+        code = krb5_cc_get_principal(creds->krb_param.context, creds->krb_param.cc, &creds->principal);
+        if (code) {
+            const char *s = krb5_get_error_message(creds->krb_param.context, code);
+            log->error(string("Error while getting principal of credential cache: ") + s);
+            krb5_cleanup(creds->krb_param);
+            creds->krb_param.context = NULL;
+            creds->krb_param.cc = NULL;
+            return 1;
+        }
+        creds->domain = domain;
+        creds->keytab_name = keytab_name;
+        creds->ccache_name = string(krb5_cc_get_type(creds->krb_param.context, creds->krb_param.cc)) + ":" +
+            krb5_cc_get_name(creds->krb_param.context, creds->krb_param.cc);
+
+        krb5_schedule_refresh(*creds);
+        wakeup.notify_all();
+    } else if (creds->refresh_at <= time(NULL)) {
+        // the old TGT is good enough, if refresh has failed before it expires
+        if (krb5_refresh_cache(*creds) != 0 && creds->endtime <= time(NULL)) {
+            return 1;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    *ccache = ccache_names.insert(creds->ccache_name).first->c_str();
+    return 0;
+}
+
+void krb5Credentials::flush() {
+/*
+  It forgets all credential caches, they are destroyed once binds using them are done.
+*/
+    std::lock_guard<std::mutex> lock(mutex);
+    caches.clear();
+}
+
+void krb5Credentials::renewLoop() {
+/*
+  It refreshes TGTs of all caches when they are due, until the process exits.
+*/
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        std::shared_ptr<krb5CachedCreds> due;
+        for (std::map <string, std::shared_ptr<krb5CachedCreds> >::iterator it = caches.begin(); it != caches.end(); ++it) {
+            time_t refresh_at = it->second->refresh_at;
+            if (refresh_at && (!due || refresh_at < due->refresh_at)) {
+                due = it->second;
+            }
+        }
+
+        if (!due) {
+            wakeup.wait(lock);
+            continue;
+        }
+        if (due->refresh_at > time(NULL)) {
+            wakeup.wait_until(lock, std::chrono::system_clock::from_time_t(due->refresh_at));
+            continue;
+        }
+
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> creds_lock(due->mutex);
+            // acquire could have refreshed it meanwhile
+            if (due->refresh_at <= time(NULL)) {
+                krb5_refresh_cache(*due);
+            }
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,268 @@
+#include "client.h"
+
+/*
+  Change notification listener.
+
+  Active Directory sends the changed entry for each change of an object under
+  the search base, while LDAP_SERVER_NOTIFICATION search is running (change type
+  is not reported). Persistent search (OpenLDAP, 389 DS and others) reports the type
+  with Entry Change Notification control. Both searches never end on their own,
+  listener polls for responses, so it notices stop() within ASYNC_POLL_TIMEOUT_MS.
+*/
+
+static LDAPControl *persistent_search_control(int change_types) {
+/*
+  It returns persistent search control { changeTypes, changesOnly, returnECs }, caller frees it.
+*/
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    if (ber == NULL) throw SearchException("Failed to allocate persistent search control", LDAP_NO_MEMORY);
+
+    struct berval value;
+    if (ber_printf(ber, "{ibb}", (ber_int_t) change_types, (ber_int_t) 1, (ber_int_t) 1) == -1 ||
+        ber_flatten2(ber, &value, 1) == -1) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to encode persistent search control", LDAP_ENCODING_ERROR);
+    }
+    ber_free(ber, 1);
+
+    LDAPControl *control = NULL;
+    int result = ldap_control_create(LDAP_CONTROL_PERSIST_REQUEST, 1, &value, 0, &control);
+    if (result != LDAP_SUCCESS) {
+        ber_memfree(value.bv_val);
+        throw SearchException(string("Failed to create persistent search control: ") + ldap_err2string(result), result);
+    }
+    return control;
+}
+
+static void parse_entry_change(LDAPControl *control, changeNotification &notice) {
+/*
+  It reads Entry Change Notification control { changeType, previousDN OPTIONAL, changeNumber OPTIONAL }.
+*/
+    BerElement *ber = ber_init(&control->ldctl_value);
+    if (ber == NULL) throw SearchException("Failed to decode entry change notification control", LDAP_DECODING_ERROR);
+
+    ber_int_t type;
+    struct berval value;
+    ber_len_t len;
+    if (ber_scanf(ber, "{e", &type) == LBER_ERROR) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to decode entry change notification control", LDAP_DECODING_ERROR);
+    }
+    notice.type = type;
+
+    if (ber_peek_tag(ber, &len) == LBER_OCTETSTRING && ber_scanf(ber, "m", &value) != LBER_ERROR) {
+        notice.previous_dn.assign(value.bv_val, value.bv_len);
+    }
+    ber_free(ber, 1);
+}
+
+changeListener::changeListener(client &c, const changeListenerParams &_params, changeHandler *_handler) :
+    owner(c), params(_params), handler(_handler), current_mode(_params.mode), stopping(false) {}
+
+changeListener::~changeListener() {
+    stop();
+}
+
+void changeListener::start() {
+/*
+  It picks the control, if it is not given, and starts listening on a new thread.
+*/
+    if (listener.joinable()) return;
+    if (owner.ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    if (current_mode == LISTEN_AUTO) {
+        current_mode = detect();
+    }
+
+    stopping = false;
+    listener = std::thread(&changeListener::run, this);
+}
+
+void changeListener::stop() {
+/*
+  It stops listening and waits for the listener thread.
+*/
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    if (listener.joinable()) {
+        listener.join();
+    }
+}
+
+int changeListener::detect() {
+/*
+  It returns the control, that server supports: notification, then persistent search.
+*/
+    vector <string> attributes;
+    attributes.push_back("supportedControl");
+
+    map <string, vector <string> > rootdse = owner.rootDSE(attributes);
+    vector <string> &controls = rootdse["supportedControl"];
+
+    if (find(controls.begin(), controls.end(), LDAP_CONTROL_AD_NOTIFICATION) != controls.end()) {
+        return LISTEN_NOTIFICATION;
+    }
+    if (find(controls.begin(), controls.end(), LDAP_CONTROL_PERSIST_REQUEST) != controls.end()) {
+        return LISTEN_PERSISTENT;
+    }
+    throw SearchException("Server supports neither change notification nor persistent search", LDAP_UNAVAILABLE_CRITICAL_EXTENSION);
+}
+
+void changeListener::run() {
+/*
+  It listens until stop(). After the session is lost, it binds again every retry_interval seconds.
+*/
+    bool resumed = false;
+
+    while (!stopping) {
+        string error;
+        try {
+            listen(resumed);
+            resumed = false;
+        } catch (Exception &ex) {
+            error = ex.msg;
+        }
+        if (stopping) break;
+
+        log->error("Change listener has stopped: " + error + ", listening again in " + itos(params.retry_interval) + "s");
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait_for(lock, std::chrono::seconds(params.retry_interval), [this] { return bool(stopping); });
+            }
+            if (stopping) break;
+
+            try {
+                owner.reconnect();
+                break;
+            } catch (BindException &ex) {
+                log->error("Change listener reconnect has failed: " + ex.msg);
+            }
+        }
+        resumed = true;
+    }
+}
+
+void changeListener::listen(bool resumed) {
+/*
+  It runs a single listening search, until stop() or error.
+  If listening has resumed, caches are cleared and handler is told, that changes could have been missed.
+*/
+    LDAP *ds = owner.ds;
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    LDAPControl *serverctrls[3] = { NULL, NULL, NULL };
+    int result;
+    if (current_mode == LISTEN_NOTIFICATION) {
+        result = ldap_control_create(LDAP_CONTROL_AD_NOTIFICATION, 1, NULL, 0, &serverctrls[0]);
+        // deleted objects are reported as tombstones, not as objects, that left the search base
+        if (result == LDAP_SUCCESS) {
+            result = ldap_control_create(LDAP_CONTROL_X_SHOW_DELETED, 0, NULL, 0, &serverctrls[1]);
+        }
+        if (result != LDAP_SUCCESS) {
+            if (serverctrls[0] != NULL) ldap_control_free(serverctrls[0]);
+            throw SearchException(string("Failed to create notification control: ") + ldap_err2string(result), result);
+        }
+    } else {
+        serverctrls[0] = persistent_search_control(params.change_types);
+    }
+
+    // changed objects are found among cached lookups by objectGUID, see client::invalidateChanged
+    vector <string> attributes = params.attributes;
+    if (current_mode == LISTEN_NOTIFICATION) entryCache::requestGUID(attributes);
+    attributeList attrs(attributes);
+    int msgid;
+    result = ldap_search_ext(ds, params.search_base.c_str(), params.scope, params.filter.c_str(), attrs.get(), 0, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &msgid);
+    ldap_control_free(serverctrls[0]);
+    if (serverctrls[1] != NULL) ldap_control_free(serverctrls[1]);
+    if (result != LDAP_SUCCESS) {
+        throw SearchException(string("Error in listener ldap_search_ext: ") + ldap_err2string(result), result);
+    }
+
+    if (resumed) {
+        if (owner.cache) owner.cache->clear();
+        if (owner.missing) owner.missing->clear();
+        if (handler != NULL) handler->missed("listening has resumed after the session was lost");
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = ASYNC_POLL_TIMEOUT_MS * 1000;
+
+    while (!stopping) {
+        LDAPMessage *res = NULL;
+        int rc = ldap_result(ds, msgid, LDAP_MSG_ONE, &timeout, &res);
+        if (rc == 0) continue;
+        if (rc < 0) {
+            ldap_get_option(ds, LDAP_OPT_RESULT_CODE, &result);
+            ldap_msgfree(res);
+            throw SearchException(string("Error in listener ldap_result: ") + ldap_err2string(result), result);
+        }
+
+        if (rc == LDAP_RES_SEARCH_RESULT) {
+            int errcodep = LDAP_OTHER;
+            result = ldap_parse_result(ds, res, &errcodep, NULL, NULL, NULL, NULL, 1);
+            if (result == LDAP_SUCCESS) result = errcodep;
+            throw SearchException(string("Listening search has ended: ") + ldap_err2string(result), result);
+        }
+
+        try {
+            if (rc == LDAP_RES_SEARCH_ENTRY) {
+                dispatch(res);
+            }
+        } catch (...) {
+            ldap_abandon_ext(ds, msgid, NULL, NULL);
+            ldap_msgfree(res);
+            throw;
+        }
+        ldap_msgfree(res);
+    }
+
+    ldap_abandon_ext(ds, msgid, NULL, NULL);
+}
+
+void changeListener::dispatch(LDAPMessage *entry) {
+/*
+  It drops cached lookups of changed entry and passes the change to handler.
+*/
+    changeNotification notice;
+    notice.entry = searchResultSet(owner.names);
+    owner._appendentry(entry, notice.entry);
+    owner._resolveranges(notice.entry, 0);
+    notice.dn = string(notice.entry.dn(0));
+
+    if (current_mode == LISTEN_PERSISTENT) {
+        LDAPControl **ctrls = NULL;
+        if (ldap_get_entry_controls(owner.ds, entry, &ctrls) == LDAP_SUCCESS) {
+            LDAPControl *control = ldap_control_find(LDAP_CONTROL_PERSIST_ENTRY_CHANGE_NOTICE, ctrls, NULL);
+            try {
+                if (control != NULL) parse_entry_change(control, notice);
+            } catch (...) {
+                ldap_controls_free(ctrls);
+                throw;
+            }
+            ldap_controls_free(ctrls);
+        }
+    } else {
+        long attr = notice.entry.findAttribute(0, "isDeleted");
+        if (attr >= 0 && notice.entry.valueCount(0, attr) > 0 && upper(string(notice.entry.value(0, attr, 0))) == "TRUE") {
+            notice.type = CHANGE_DELETE;
+        }
+    }
+
+    if (current_mode == LISTEN_NOTIFICATION) {
+        long attr = notice.entry.findAttribute(0, "objectGUID");
+        owner.invalidateChanged(notice.dn, attr >= 0 && notice.entry.valueCount(0, attr) > 0 ? string(notice.entry.value(0, attr, 0)) : "");
+    } else {
+        owner.invalidate(notice.dn, notice.type == CHANGE_DELETE || notice.type == CHANGE_MODDN);
+    }
+    if (!notice.previous_dn.empty()) {
+        owner.invalidate(notice.previous_dn, true);
+    }
+
+    if (handler != NULL) handler->notify(notice);
+}
@@ -0,0 +1,224 @@
+#include "client.h"
+
+/*
+  Bulk base lookups.
+
+  Each object is looked up with its own base search, so objects of any naming context
+  are found and each of them keeps its own result. Searches are pipelined over the
+  bound connection with async requests, up to lookup_window of them in flight at once,
+  instead of waiting for a round trip per object.
+*/
+
+// lookup in flight
+struct sentLookup {
+    string dn;
+    int msgid;
+    // cache generations of dn, when the lookup was sent
+    uint64_t generation;
+    uint64_t missing_generation;
+};
+
+static bool session_lost(int code) {
+    return code == LDAP_SERVER_DOWN || code == LDAP_CONNECT_ERROR;
+}
+
+map <string, lookupResult> client::bulkLookup(const vector <string> &objects, const vector <string> &attributes, const string &selector) {
+/*
+  It returns result of base lookup of attributes of each given DN.
+  DNs, that differ only in case or spacing, are looked up once. Lookups are answered
+  from entry cache (with 'selector' of the lookup) and negative cache if possible,
+  and their results are cached.
+  Lookups lost with the session are sent again after reconnect (read_retries).
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    map <string, lookupResult> results;
+    // first given DN of each normalized DN
+    map <string, string> unique;
+    vector <string> pending;
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const string &dn = objects[i];
+        if (!unique.insert(std::make_pair(entryCache::normalize(dn), dn)).second) continue;
+
+        lookupResult &result = results[dn];
+        if (cache && cache->get(dn, selector, result.attributes)) continue;
+        if (missing && missing->get(dn, "", result.code, result.error_msg)) continue;
+        pending.push_back(dn);
+    }
+
+    // cached objects are known by objectGUID too, see entryCache::findGUID
+    vector <string> requested = attributes;
+    bool guid_added = cache && entryCache::requestGUID(requested);
+
+    size_t window = std::max(params.lookup_window, 1);
+    for (int attempt = 0; !pending.empty(); ++attempt) {
+        vector <string> lost;
+        SearchException lost_error("", LDAP_SUCCESS);
+
+        std::deque <sentLookup> inflight;
+        size_t next = 0;
+        while (next < pending.size() || !inflight.empty()) {
+            for (; next < pending.size() && inflight.size() < window; ++next) {
+                try {
+                    sentLookup sent;
+                    sent.dn = pending[next];
+                    sent.generation = cache ? cache->generation(sent.dn) : 0;
+                    sent.missing_generation = missing ? missing->generation(sent.dn) : 0;
+                    sent.msgid = asyncSearch(sent.dn, "(objectclass=*)", LDAP_SCOPE_BASE, requested);
+                    inflight.push_back(sent);
+                } catch (SearchException &ex) {
+                    if (session_lost(ex.code)) {
+                        lost.push_back(pending[next]);
+                        lost_error = ex;
+                        continue;
+                    }
+                    results[pending[next]].code = ex.code;
+                    results[pending[next]].error_msg = ex.msg;
+                }
+            }
+            if (inflight.empty()) continue;
+
+            sentLookup sent = inflight.front();
+            inflight.pop_front();
+            const string &dn = sent.dn;
+
+            lookupResult &result = results[dn];
+            try {
+                asyncResult found = asyncWait(sent.msgid);
+                _resolveranges(found.entries, 0);
+                if (found.entries.size() > 0) {
+                    result.attributes = found.entries.toMap().begin()->second;
+                }
+                if (cache) {
+                    string guid = entryCache::takeGUID(result.attributes, guid_added);
+                    cache->put(dn, selector, result.attributes, sent.generation, guid);
+                }
+            } catch (SearchException &ex) {
+                if (session_lost(ex.code)) {
+                    lost.push_back(dn);
+                    lost_error = ex;
+                    continue;
+                }
+                result.code = ex.code;
+                result.error_msg = "Object '" + dn + "': " + ex.msg;
+                if (missing && negativeCache::missing(ex.code)) {
+                    missing->put(dn, "", result.code, result.error_msg, sent.missing_generation);
+                }
+            }
+        }
+
+        pending.clear();
+        if (lost.empty()) break;
+        if (retryRead(lost_error.code, attempt)) {
+            pending = lost;
+            continue;
+        }
+        for (size_t i = 0; i < lost.size(); ++i) {
+            results[lost[i]].code = lost_error.code;
+            results[lost[i]].error_msg = lost_error.msg;
+        }
+    }
+
+    // the same object given with other spelling of its DN
+    for (size_t i = 0; i < objects.size(); ++i) {
+        if (results.find(objects[i]) == results.end()) {
+            results[objects[i]] = results[unique[entryCache::normalize(objects[i])]];
+        }
+    }
+    return results;
+}
+
+map <string, lookupResult> client::getObjectsAttributes(const vector <string> &objects, const vector <string> &attributes) {
+/*
+  It returns result of lookup of given attributes (all of them, if none are given) of each object.
+  Failure of a lookup is reported in its result, it does not fail the others.
+*/
+    if (attributes.empty()) {
+        vector <string> all;
+        all.push_back("*");
+        return bulkLookup(objects, all, entryCache::selector(all));
+    }
+    return bulkLookup(objects, attributes, entryCache::selector(attributes));
+}
+
+map <string, vector <string> > client::resolveAttribute(const vector <string> &objects, string attribute) {
+/*
+  It returns values of attribute of each given DN with bulk lookup. Objects, that are
+  missing or have no such attribute, are left out of result, other failures are thrown.
+  Attribute name is matched ignoring case, values are keyed by DNs as given.
+*/
+    vector <string> attributes;
+    attributes.push_back(attribute);
+    string selector = entryCache::selector(attributes);
+
+    // objects known to lack the attribute are not looked up again
+    vector <string> wanted;
+    map <string, uint64_t> missing_generations;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        int code;
+        string msg;
+        if (missing && missing->get(objects[i], selector, code, msg)) continue;
+        wanted.push_back(objects[i]);
+        if (missing) missing_generations[objects[i]] = missing->generation(objects[i]);
+    }
+
+    map <string, lookupResult> found = bulkLookup(wanted, attributes, selector);
+
+    map <string, vector <string> > values;
+    for (map <string, lookupResult>::iterator it = found.begin(); it != found.end(); ++it) {
+        if (it->second.code != LDAP_SUCCESS) {
+            if (negativeCache::missing(it->second.code)) continue;
+            throw SearchException(it->second.error_msg, it->second.code);
+        }
+
+        map <string, vector <string> >::iterator attr = it->second.attributes.begin();
+        for (; attr != it->second.attributes.end(); ++attr) {
+            if (strcasecmp(attr->first.c_str(), attribute.c_str()) == 0) break;
+        }
+        if (attr == it->second.attributes.end()) {
+            if (missing) {
+                missing->put(it->first, selector, ATTRIBUTE_ENTRY_NOT_FOUND, "No such attribute '" + attribute + "' in '" + it->first + "'", missing_generations[it->first]);
+            }
+            continue;
+        }
+        values[it->first] = attr->second;
+    }
+    return values;
+}
+
+map <string, bool> client::exists(const vector <string> &objects) {
+/*
+  It returns existence of each given DN, like ifDNExists for many DNs at once.
+  Base searches return no attributes and share cached lookups with ifDNExists.
+  Failures other than missing object are thrown.
+*/
+    vector <string> attributes;
+    attributes.push_back("1.1");
+    string selector = "?exists:*";
+
+    map <string, bool> result;
+    // objects known to be missing are not looked up again
+    vector <string> wanted;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        int code;
+        string msg;
+        if (missing && missing->get(objects[i], selector, code, msg)) {
+            result[objects[i]] = false;
+            continue;
+        }
+        wanted.push_back(objects[i]);
+    }
+
+    map <string, lookupResult> found = bulkLookup(wanted, attributes, selector);
+    for (map <string, lookupResult>::iterator it = found.begin(); it != found.end(); ++it) {
+        if (it->second.code == LDAP_SUCCESS) {
+            result[it->first] = true;
+        } else if (negativeCache::missing(it->second.code)) {
+            result[it->first] = false;
+        } else {
+            throw SearchException(it->second.error_msg, it->second.code);
+        }
+    }
+    return result;
+}
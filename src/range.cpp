@@ -0,0 +1,199 @@
+#include "client.h"
+
+/*
+  Ranged retrieval of multi-valued attributes.
+
+  Active Directory returns at most MaxValRange values of an attribute (1500 by
+  default) and names the attribute after the returned range, e.g. "member;range=0-1499".
+  Remaining values are asked with "member;range=1500-*", the last range ends with "*".
+  Other servers return all values under the plain name, so nothing is fetched there.
+*/
+
+static const char RANGE_OPTION[] = ";range=";
+// option of the first range, e.g. "member;range=0-1499"
+static const char RANGE_FIRST[] = ";range=0-";
+
+static bool parse_range(const string &name, string &attribute, long &end) {
+/*
+  It splits "attribute;range=low-high" into attribute and high, high is -1 for the last range ("*").
+  It returns false if name has no range option.
+*/
+    string lowered = name;
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+    size_t pos = lowered.find(RANGE_OPTION);
+    if (pos == string::npos) return false;
+
+    size_t dash = name.find('-', pos + sizeof(RANGE_OPTION) - 1);
+    if (dash == string::npos) return false;
+
+    attribute = name.substr(0, pos);
+    string high = name.substr(dash + 1);
+    end = (high == "*") ? -1 : atol(high.c_str());
+    return true;
+}
+
+string client::_getrange(string dn, string attribute, long start, vector <string> &values) {
+/*
+  It appends values of range, that starts at 'start', of attribute of dn to 'values'.
+  It returns name of the returned attribute ("member;range=1500-2999", "member" if it is not ranged),
+  empty if object has no values left. It is sent once, callers decide on retries.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    vector <string> requested;
+    requested.push_back(start > 0 ? attribute + RANGE_OPTION + itos(start) + "-*" : attribute);
+    attributeList attrs(requested);
+
+    LDAPMessage *res = NULL;
+    // a range holds up to MaxValRange values, it is not a latency sample
+    int result = ldap_search_ext_s(ds, dn.c_str(), LDAP_SCOPE_BASE, "(objectclass=*)", attrs.get(), 0, NULL, NULL, NULL, 1, &res);
+    observe(result);
+    if (result != LDAP_SUCCESS) {
+        ldap_msgfree(res);
+        if (result == LDAP_NO_SUCH_OBJECT) throw SearchException("Object not found: " + dn, OBJECT_NOT_FOUND);
+        throw SearchException(string("Error in range ldap_search_ext_s: ") + ldap_err2string(result), result);
+    }
+
+    string name;
+    LDAPMessage *entry = ldap_first_entry(ds, res);
+    BerElement *berptr = NULL;
+    char *next = (entry != NULL) ? ldap_first_attribute(ds, entry, &berptr) : NULL;
+    if (next != NULL) {
+        struct berval **vals = ldap_get_values_len(ds, entry, next);
+        if (vals != NULL) {
+            name = next;
+            for (unsigned int i = 0; vals[i] != NULL; ++i) {
+                values.push_back(string(vals[i]->bv_val, vals[i]->bv_len));
+            }
+            ldap_value_free_len(vals);
+        }
+        ldap_memfree(next);
+    }
+    if (berptr != NULL) ber_free(berptr, 0);
+    ldap_msgfree(res);
+
+    return name;
+}
+
+void client::_appendranges(string dn, string attribute, long next_start, searchResultSet &into) {
+/*
+  It appends remaining ranges of attribute, that starts at 'next_start', to the last attribute of 'into',
+  until the last range or params.max_range_values values. The attribute is renamed to 'attribute' when all
+  values are there, otherwise to the range kept ("member;range=0-2999"), as the server would name it.
+*/
+    long limit = params.max_range_values;
+    long count = next_start;
+    bool complete = false;
+
+    while (limit <= 0 || count < limit) {
+        vector <string> values;
+        string name = _getrange(dn, attribute, next_start, values);
+
+        string returned;
+        long end = -1;
+        if (!name.empty()) parse_range(name, returned, end);
+
+        size_t take = values.size();
+        if (limit > 0 && count + (long) take > limit) take = limit - count;
+        for (size_t i = 0; i < take; ++i) {
+            into.addValue(values[i]);
+        }
+        count += take;
+
+        if (take < values.size()) break;
+        if (end < 0 || values.empty()) {
+            complete = true;
+            break;
+        }
+        next_start = end + 1;
+    }
+
+    into.renameAttribute(complete ? attribute : attribute + RANGE_OPTION + "0-" + itos(count - 1));
+}
+
+void client::_resolveranges(searchResultSet &into, size_t first) {
+/*
+  It fetches remaining ranges of ranged attributes of entries from 'first' on, and
+  names attributes without the range option when all values are there. Callers free
+  the response first, as ranges are fetched with new searches. Entries are rebuilt aside,
+  so 'into' is not changed if it fails.
+*/
+    size_t ranged = into.firstRanged(first);
+    if (ranged == into.size()) return;
+
+    searchResultSet resolved(names);
+    for (size_t i = ranged; i < into.size(); ++i) {
+        string dn(into.dn(i));
+        resolved.addEntry(dn);
+        for (size_t j = 0; j < into.attributeCount(i); ++j) {
+            std::string_view name = into.attributeName(i, j);
+            size_t option = name.find(RANGE_FIRST);
+            resolved.addAttribute(name.substr(0, option));
+            for (size_t k = 0; k < into.valueCount(i, j); ++k) {
+                resolved.addValue(into.value(i, j, k));
+            }
+            // the last range ends with "*"
+            if (option != std::string_view::npos && name.substr(name.size() - 2) != "-*") {
+                _appendranges(dn, string(name.substr(0, option)), into.valueCount(i, j), resolved);
+            }
+        }
+    }
+
+    into.truncate(ranged);
+    into.append(resolved);
+}
+
+size_t searchResultSet::firstRanged(size_t from) const {
+/*
+  It returns index of the first entry from 'from' on, that has an attribute with the first range only.
+*/
+    for (size_t i = from; i < size(); ++i) {
+        for (size_t j = 0; j < attributeCount(i); ++j) {
+            if (attributeName(i, j).find(RANGE_FIRST) != std::string_view::npos) return i;
+        }
+    }
+    return size();
+}
+
+attributeCursor *client::openAttribute(string object, string attribute) {
+/*
+  It returns cursor, that fetches values of attribute of object range by range.
+  Caller owns returned cursor, it must be deleted before the client.
+*/
+    if (ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    return new attributeCursor(this, object, attribute);
+}
+
+attributeCursor::attributeCursor(client *_owner, string _dn, string _attribute) :
+    owner(_owner), dn(_dn), attribute(_attribute), next_start(0), done(false) {}
+
+bool attributeCursor::next() {
+/*
+  It fetches the next range into values(). It returns false when there are no values left.
+  Ranges are independent of the session, so lost session is re-established and the range asked again.
+*/
+    current.clear();
+    if (done) return false;
+
+    string name;
+    for (int attempt = 0; ; ++attempt) {
+        try {
+            name = owner->_getrange(dn, attribute, next_start, current);
+            break;
+        } catch (SearchException &ex) {
+            current.clear();
+            if (owner->retryRead(ex.code, attempt)) continue;
+            throw;
+        }
+    }
+
+    string returned;
+    long end;
+    if (name.empty() || !parse_range(name, returned, end) || end < 0 || current.empty()) {
+        done = true;
+    } else {
+        next_start = end + 1;
+    }
+    return !current.empty();
+}
@@ -0,0 +1,368 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "client.h"
+
+/*
+  Arena-backed search result set.
+
+  Every DN and value is appended to a single string arena, attribute names are
+  interned in the shared names table. Entries and attributes are located
+  by offset tables (not pointers), so growing the arena does not invalidate them.
+*/
+
+// well-known attribute names (RFC 4519, RFC 2798, Active Directory), their ids are fixed
+static const char *const well_known_attributes[] = {
+    // RFC 4519
+    "businessCategory", "c", "cn", "dc", "description", "destinationIndicator",
+    "distinguishedName", "dnQualifier", "enhancedSearchGuide", "facsimileTelephoneNumber",
+    "generationQualifier", "givenName", "houseIdentifier", "initials",
+    "internationalISDNNumber", "l", "member", "name", "o", "objectClass", "ou", "owner",
+    "physicalDeliveryOfficeName", "postalAddress", "postalCode", "postOfficeBox",
+    "preferredDeliveryMethod", "registeredAddress", "roleOccupant", "searchGuide",
+    "seeAlso", "serialNumber", "sn", "st", "street", "telephoneNumber",
+    "teletexTerminalIdentifier", "telexNumber", "title", "uid", "uniqueMember",
+    "userPassword", "x121Address", "x500UniqueIdentifier",
+    // RFC 2798, RFC 2307
+    "displayName", "employeeNumber", "employeeType", "mail", "manager", "mobile",
+    "departmentNumber", "jpegPhoto", "userCertificate", "memberUid", "uidNumber",
+    "gidNumber", "homeDirectory", "loginShell",
+    // Active Directory
+    "sAMAccountName", "sAMAccountType", "userPrincipalName", "objectGUID", "objectSid",
+    "objectCategory", "memberOf", "primaryGroupID", "userAccountControl",
+    "msDS-User-Account-Control-Computed", "pwdLastSet", "accountExpires", "lastLogon",
+    "lastLogonTimestamp", "badPwdCount", "badPasswordTime", "lockoutTime", "logonCount",
+    "whenCreated", "whenChanged", "uSNCreated", "uSNChanged", "instanceType", "groupType",
+    "department", "company", "thumbnailPhoto", "proxyAddresses", "servicePrincipalName",
+    "dNSHostName", "operatingSystem", "operatingSystemVersion", "tokenGroups",
+    "msDS-PrincipalName", "managedBy", "isDeleted", "lastKnownParent", "gPLink",
+    "adminCount", "mailNickname", "homeMDB", "legacyExchangeDN", "sIDHistory",
+    "primaryGroupToken", "nTSecurityDescriptor", "dSCorePropagationData",
+    "countryCode", "codePage", "info", "employeeID", "extensionAttribute1",
+    "extensionAttribute2",
+};
+
+static const size_t well_known_count = sizeof(well_known_attributes) / sizeof(well_known_attributes[0]);
+
+static const std::unordered_map <std::string_view, uint32_t> &well_known_ids() {
+    static const std::unordered_map <std::string_view, uint32_t> ids = [] {
+        std::unordered_map <std::string_view, uint32_t> m;
+        for (size_t i = 0; i < well_known_count; ++i) {
+            m.emplace(well_known_attributes[i], i);
+        }
+        return m;
+    }();
+    return ids;
+}
+
+std::shared_ptr <attributeNames> attributeNames::shared() {
+    static std::shared_ptr <attributeNames> table = std::make_shared<attributeNames>();
+    return table;
+}
+
+uint32_t attributeNames::intern(std::string_view name) {
+/*
+  It returns id of the name, adding the name to the table if it is new.
+*/
+    const std::unordered_map <std::string_view, uint32_t> &known = well_known_ids();
+    std::unordered_map <std::string_view, uint32_t>::const_iterator it = known.find(name);
+    if (it != known.end()) {
+        return it->second;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    names.push_back(string(name));
+    uint32_t id = well_known_count + names.size() - 1;
+    ids.emplace(names.back(), id);
+    return id;
+}
+
+std::string_view attributeNames::name(uint32_t id) const {
+    if (id < well_known_count) {
+        return well_known_attributes[id];
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.at(id - well_known_count);
+}
+
+searchResultSet::searchResultSet() :
+    names(attributeNames::shared()), vlv_target_position(0), vlv_content_count(0) {}
+
+searchResultSet::searchResultSet(std::shared_ptr <attributeNames> _names) :
+    names(_names), vlv_target_position(0), vlv_content_count(0) {}
+
+void searchResultSet::clear() {
+    arena.clear();
+    entries.clear();
+    attributes.clear();
+    values.clear();
+    vlv_target_position = 0;
+    vlv_content_count = 0;
+}
+
+searchResultSet::span searchResultSet::store(std::string_view data) {
+    span s;
+    s.offset = arena.size();
+    s.length = data.size();
+    arena.append(data.data(), data.size());
+    return s;
+}
+
+const searchResultSet::attributeIndex &searchResultSet::attribute(size_t entry, size_t attr) const {
+    const entryIndex &e = entries.at(entry);
+    if (attr >= e.attr_count) {
+        throw std::out_of_range("searchResultSet: attribute index " + itos(attr) + " is out of range");
+    }
+    return attributes[e.first_attr + attr];
+}
+
+std::string_view searchResultSet::value(size_t entry, size_t attr, size_t value) const {
+    const attributeIndex &a = attribute(entry, attr);
+    if (value >= a.value_count) {
+        throw std::out_of_range("searchResultSet: value index " + itos(value) + " is out of range");
+    }
+    return view(values[a.first_value + value]);
+}
+
+long searchResultSet::findAttribute(size_t entry, std::string_view name) const {
+    const entryIndex &e = entries.at(entry);
+    for (size_t i = 0; i < e.attr_count; ++i) {
+        if (attributeName(attributes[e.first_attr + i]) == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void searchResultSet::addEntry(std::string_view dn) {
+/*
+  It starts a new entry, following attributes are added to it.
+*/
+    entryIndex e;
+    e.dn = store(dn);
+    e.first_attr = attributes.size();
+    e.attr_count = 0;
+    entries.push_back(e);
+}
+
+void searchResultSet::addAttribute(std::string_view name) {
+/*
+  It starts a new attribute of the last entry, following values are added to it.
+*/
+    if (entries.empty()) throw std::logic_error("searchResultSet: attribute without entry");
+
+    attributeIndex a;
+    setName(a, name);
+    a.first_value = values.size();
+    a.value_count = 0;
+    attributes.push_back(a);
+    entries.back().attr_count++;
+}
+
+void searchResultSet::addValue(std::string_view value) {
+/*
+  It adds a value to the last attribute.
+*/
+    if (attributes.empty()) throw std::logic_error("searchResultSet: value without attribute");
+
+    values.push_back(store(value));
+    attributes.back().value_count++;
+}
+
+void searchResultSet::renameAttribute(std::string_view name) {
+    if (attributes.empty()) throw std::logic_error("searchResultSet: rename without attribute");
+
+    setName(attributes.back(), name);
+}
+
+void searchResultSet::truncate(size_t count) {
+/*
+  It drops entries from 'count' on, with their data: entry data is appended in order,
+  so it starts with DN of the first dropped entry.
+*/
+    if (count >= entries.size()) return;
+
+    const entryIndex &e = entries[count];
+    arena.resize(e.dn.offset);
+    if (e.first_attr < attributes.size()) {
+        values.resize(attributes[e.first_attr].first_value);
+    }
+    attributes.resize(e.first_attr);
+    entries.resize(count);
+}
+
+void searchResultSet::setName(attributeIndex &a, std::string_view name) {
+/*
+  It interns the name, unless it has options ("member;range=0-1499"): spellings of
+  those are countless, so they are kept in the arena and the table stays bounded.
+*/
+    if (name.find(';') != std::string_view::npos) {
+        a.name_id = LOCAL_NAME;
+        a.name = store(name);
+    } else {
+        a.name_id = names->intern(name);
+    }
+}
+
+std::string_view searchResultSet::attributeName(const attributeIndex &a) const {
+    return a.name_id == LOCAL_NAME ? view(a.name) : names->name(a.name_id);
+}
+
+void searchResultSet::append(const searchResultSet &other) {
+/*
+  It appends all entries of other set, offsets are rebased to this arena.
+  Attribute names are interned again, if other set belongs to another connection.
+*/
+    size_t arena_base = arena.size();
+    size_t attr_base = attributes.size();
+    size_t value_base = values.size();
+
+    arena.append(other.arena);
+
+    entries.reserve(entries.size() + other.entries.size());
+    for (size_t i = 0; i < other.entries.size(); ++i) {
+        entryIndex e = other.entries[i];
+        e.dn.offset += arena_base;
+        e.first_attr += attr_base;
+        entries.push_back(e);
+    }
+    attributes.reserve(attributes.size() + other.attributes.size());
+    for (size_t i = 0; i < other.attributes.size(); ++i) {
+        attributeIndex a = other.attributes[i];
+        if (a.name_id == LOCAL_NAME) {
+            a.name.offset += arena_base;
+        } else if (other.names != names) {
+            a.name_id = names->intern(other.names->name(a.name_id));
+        }
+        a.first_value += value_base;
+        attributes.push_back(a);
+    }
+    values.reserve(values.size() + other.values.size());
+    for (size_t i = 0; i < other.values.size(); ++i) {
+        span v = other.values[i];
+        v.offset += arena_base;
+        values.push_back(v);
+    }
+}
+
+map < string, map < string, vector<string> > > searchResultSet::toMap() const {
+/*
+  It converts set to nested maps, as returned by searchEntries.
+  Server order is lost, the last of duplicate DNs wins.
+*/
+    map < string, map < string, vector<string> > > result;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        map < string, vector<string> > &attrs = result[string(dn(i))];
+        attrs.clear();
+        for (size_t j = 0; j < entries[i].attr_count; ++j) {
+            const attributeIndex &a = attributes[entries[i].first_attr + j];
+            vector <string> &vals = attrs[string(attributeName(a))];
+            vals.reserve(a.value_count);
+            for (size_t k = 0; k < a.value_count; ++k) {
+                vals.push_back(string(view(values[a.first_value + k])));
+            }
+        }
+    }
+
+    return result;
+}
+
+static char *put_uint32(char *p, size_t value) {
+    p[0] = char(value & 0xff);
+    p[1] = char((value >> 8) & 0xff);
+    p[2] = char((value >> 16) & 0xff);
+    p[3] = char((value >> 24) & 0xff);
+    return p + 4;
+}
+
+size_t searchResultSet::usedNames(std::unordered_map <std::string_view, uint32_t> &name_index, std::vector <std::string_view> &used_names, std::vector <uint32_t> &used_ids) const {
+/*
+  It sets local name indexes of attribute names, in order of first use, and returns their total size.
+*/
+    size_t names_size = 0;
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        std::string_view name = attributeName(attributes[i]);
+        if (name_index.emplace(name, used_names.size()).second) {
+            used_names.push_back(name);
+            used_ids.push_back(attributes[i].name_id);
+            names_size += name.size();
+        }
+    }
+    return names_size;
+}
+
+size_t searchResultSet::serializedSize() const {
+    std::unordered_map <std::string_view, uint32_t> name_index;
+    std::vector <std::string_view> used_names;
+    std::vector <uint32_t> used_ids;
+    size_t names_size = usedNames(name_index, used_names, used_ids);
+
+    return 4 * (5 + 3 * entries.size() + 3 * used_names.size() + 2 * attributes.size() + 2 * values.size()) + arena.size() + names_size;
+}
+
+void searchResultSet::serialize(char *buf, size_t size) const {
+/*
+  It writes the whole set into buf of serializedSize() bytes, so it could be passed to Go
+  with a single call. buf is owned by the caller (a Go []byte), so the arena is copied once.
+  All numbers are little-endian uint32, offsets are relative to the arena.
+  Attribute names used by the set are stored once, after entries data in the arena:
+
+    header:     entry count, name count, attribute count, value count, arena size
+    entries:    dn offset, dn length, attribute count      (per entry)
+    names:      name offset, name length, name id          (per distinct name, id in the shared
+                                                            attributeNames table, UINT32_MAX
+                                                            for names with options)
+    attributes: name index, value count                    (per attribute, in entry order)
+    values:     value offset, value length                 (per value, in attribute order)
+    arena
+*/
+    std::unordered_map <std::string_view, uint32_t> name_index;
+    std::vector <std::string_view> used_names;
+    std::vector <uint32_t> used_ids;
+    size_t names_size = usedNames(name_index, used_names, used_ids);
+
+    if (size != 4 * (5 + 3 * entries.size() + 3 * used_names.size() + 2 * attributes.size() + 2 * values.size()) + arena.size() + names_size) {
+        throw SearchException("Buffer of serialized search result has wrong size", PARAMS_ERROR);
+    }
+
+    char *p = buf;
+    p = put_uint32(p, entries.size());
+    p = put_uint32(p, used_names.size());
+    p = put_uint32(p, attributes.size());
+    p = put_uint32(p, values.size());
+    p = put_uint32(p, arena.size() + names_size);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        p = put_uint32(p, entries[i].dn.offset);
+        p = put_uint32(p, entries[i].dn.length);
+        p = put_uint32(p, entries[i].attr_count);
+    }
+    size_t offset = arena.size();
+    for (size_t i = 0; i < used_names.size(); ++i) {
+        p = put_uint32(p, offset);
+        p = put_uint32(p, used_names[i].size());
+        p = put_uint32(p, used_ids[i]);
+        offset += used_names[i].size();
+    }
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        p = put_uint32(p, name_index[attributeName(attributes[i])]);
+        p = put_uint32(p, attributes[i].value_count);
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        p = put_uint32(p, values[i].offset);
+        p = put_uint32(p, values[i].length);
+    }
+    memcpy(p, arena.data(), arena.size());
+    p += arena.size();
+    for (size_t i = 0; i < used_names.size(); ++i) {
+        memcpy(p, used_names[i].data(), used_names[i].size());
+        p += used_names[i].size();
+    }
+}
@@ -7,6 +7,10 @@
 
 #include "client.h"
 
+#ifdef KRB5
+#include <gssapi/gssapi_krb5.h>
+#endif
+
 using std::string;
 using std::cout;
 using std::endl;
@@ -140,7 +144,12 @@ int sasl_interact_gssapi(LDAP *ds, unsigned flags, void *indefaults, void *in) {
     return LDAP_SUCCESS;
 }
 
-int sasl_bind_gssapi(LDAP *ds) {
+int sasl_bind_gssapi(LDAP *ds, const char *ccache) {
+/*
+  It binds with GSSAPI credentials of ccache, or of the default cache if ccache is NULL.
+  Cache is selected for the calling thread only (MIT gss_krb5_ccache_name is thread-specific),
+  so concurrent binds with different caches do not interfere.
+*/
     std::stringstream log_msg;
 
     unsigned sasl_flags = LDAP_SASL_QUIET;
@@ -168,10 +177,35 @@ int sasl_bind_gssapi(LDAP *ds) {
     // std::chrono::seconds dura(15);
     // std::this_thread::sleep_for(dura);
 
+    OM_uint32 minor;
+    const char *previous_ccache = NULL;
+    string restore_ccache;
+    if (ccache) {
+        if (GSS_ERROR(gss_krb5_ccache_name(&minor, ccache, &previous_ccache))) {
+            log_msg.str("");
+            log_msg << "Could not select credential cache " << ccache;
+            log->error(log_msg.str());
+
+            free(defaults.mech);
+            ldap_memfree(defaults.realm);
+            ldap_memfree(defaults.authcid);
+            ldap_memfree(defaults.authzid);
+            return LDAP_LOCAL_ERROR;
+        }
+        // previous name is owned by the library, until the next call
+        if (previous_ccache) {
+            restore_ccache = previous_ccache;
+        }
+    }
+
     rc = ldap_sasl_interactive_bind_s(ds, NULL,
                                       sasl_mech.c_str(), NULL, NULL,
                                       sasl_flags, sasl_interact_gssapi, &defaults);
 
+    if (ccache) {
+        gss_krb5_ccache_name(&minor, restore_ccache.empty() ? NULL : restore_ccache.c_str(), NULL);
+    }
+
     free(defaults.mech);
     ldap_memfree(defaults.realm);
     ldap_memfree(defaults.authcid);
@@ -191,6 +225,7 @@ int sasl_rebind_gssapi(LDAP * ld,
                               ber_tag_t request,
                               ber_int_t msgid,
                               void *params) {
-    return sasl_bind_gssapi(ld);
+    // params is the credential cache name of the initial bind
+    return sasl_bind_gssapi(ld, static_cast<const char *>(params));
 }
 #endif
@@ -0,0 +1,245 @@
+#include "client.h"
+
+/*
+  Domain controller scoreboard.
+
+  Every server has EWMA of round trip time (of probes, binds and cheap base operations,
+  so servers of large searches are not ranked as slow) and of error rate (of all operations),
+  and a circuit breaker: after SCOREBOARD_BREAKER_FAILURES consecutive failures server
+  is skipped for SCOREBOARD_BREAKER_COOLDOWN seconds, then it is half-open: a single
+  caller gets it as a trial, that decides if it is back, others skip it meanwhile.
+  Servers without samples are scored optimistically, so each of them is tried
+  before selection settles on the fastest one.
+*/
+
+dcScoreboard &dcScoreboard::instance() {
+    static dcScoreboard scoreboard;
+    return scoreboard;
+}
+
+string dcScoreboard::key(string uri) {
+/*
+  It strips scheme and path from uri, "ldap://DC1.example.com:389/" -> "dc1.example.com:389".
+*/
+    size_t pos = uri.find("://");
+    if (pos != string::npos) {
+        uri = uri.substr(pos + 3);
+    }
+    pos = uri.find('/');
+    if (pos != string::npos) {
+        uri = uri.substr(0, pos);
+    }
+    std::transform(uri.begin(), uri.end(), uri.begin(), ::tolower);
+    return uri;
+}
+
+bool dcScoreboard::serverFailure(int result) {
+    return result == LDAP_SERVER_DOWN ||
+           result == LDAP_TIMEOUT ||
+           result == LDAP_CONNECT_ERROR ||
+           result == LDAP_BUSY ||
+           result == LDAP_UNAVAILABLE;
+}
+
+void dcScoreboard::success(string server, double rtt_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    dcStats &s = servers[key(server)];
+    if (rtt_ms >= 0) {
+        s.rtt_ms = (s.rtt_samples == 0) ? rtt_ms : SCOREBOARD_EWMA_ALPHA * rtt_ms + (1 - SCOREBOARD_EWMA_ALPHA) * s.rtt_ms;
+        s.rtt_samples++;
+    }
+    s.error_rate = (1 - SCOREBOARD_EWMA_ALPHA) * s.error_rate;
+    s.samples++;
+    s.consecutive_failures = 0;
+    s.open_until = 0;
+    s.trial_until = 0;
+}
+
+void dcScoreboard::failure(string server) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    dcStats &s = servers[key(server)];
+    s.error_rate = SCOREBOARD_EWMA_ALPHA + (1 - SCOREBOARD_EWMA_ALPHA) * s.error_rate;
+    s.samples++;
+    s.consecutive_failures++;
+    if (s.consecutive_failures >= SCOREBOARD_BREAKER_FAILURES) {
+        // opens the breaker, or reopens it after failed trial
+        s.open_until = time(NULL) + SCOREBOARD_BREAKER_COOLDOWN;
+        s.trial_until = 0;
+        if (log) log->debug("DC " + key(server) + " is skipped for " + itos(SCOREBOARD_BREAKER_COOLDOWN) + "s after " + itos(s.consecutive_failures) + " failures");
+    }
+}
+
+void dcScoreboard::setSite(string server, string site) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    servers[key(server)].site = site;
+}
+
+dcStats dcScoreboard::stats(string server) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::map <string, dcStats>::iterator it = servers.find(key(server));
+    if (it == servers.end()) {
+        return dcStats();
+    }
+    return it->second;
+}
+
+void dcScoreboard::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    servers.clear();
+}
+
+static bool usable(const dcStats &s, time_t now) {
+/*
+  It returns true if server could be used: its breaker is closed, or the cooldown is over
+  and nobody has the trial. It only reads the state, see admit.
+*/
+    if (s.consecutive_failures < SCOREBOARD_BREAKER_FAILURES) return true;
+    return s.open_until <= now && s.trial_until <= now;
+}
+
+static bool admit(dcStats &s, time_t now) {
+/*
+  It returns true if server could be used: its breaker is closed, or the cooldown is over
+  and nobody has the trial, then the caller takes it for SCOREBOARD_TRIAL_TIMEOUT seconds.
+*/
+    if (!usable(s, now)) return false;
+    if (s.consecutive_failures < SCOREBOARD_BREAKER_FAILURES) return true;
+    s.trial_until = now + SCOREBOARD_TRIAL_TIMEOUT;
+    return true;
+}
+
+bool dcScoreboard::available(string server) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::map <string, dcStats>::iterator it = servers.find(key(server));
+    return it == servers.end() || admit(it->second, time(NULL));
+}
+
+std::vector<string> dcScoreboard::rank(const std::vector<string> &uries, string site) {
+/*
+  It returns uries ordered by preference, servers with open breaker (or with trial taken by
+  another caller) go last, they are still tried, if nothing else works. Equal servers keep given order.
+  Ranking does not take trials, the caller takes one with available() when it connects.
+*/
+    struct candidate {
+        bool available;
+        bool in_site;
+        double score;
+        size_t index;
+    };
+
+    vector <candidate> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        time_t now = time(NULL);
+
+        for (size_t i = 0; i < uries.size(); ++i) {
+            candidate c = {true, false, 0, i};
+
+            std::map <string, dcStats>::iterator it = servers.find(key(uries[i]));
+            if (it != servers.end()) {
+                const dcStats &s = it->second;
+                c.available = usable(s, now);
+                c.in_site = !site.empty() && s.site == site;
+                c.score = s.rtt_ms * (1 + s.error_rate * SCOREBOARD_ERROR_PENALTY);
+            }
+            candidates.push_back(c);
+        }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const candidate &a, const candidate &b) {
+        if (a.available != b.available) return a.available;
+        if (a.in_site != b.in_site) return a.in_site;
+        return a.score < b.score;
+    });
+
+    vector <string> ranked;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        ranked.push_back(uries[candidates[i].index]);
+    }
+    return ranked;
+}
+
+bool client::probe(string uri, int timeout_ms) {
+/*
+  It reads rootDSE of uri anonymously (over UDP for cldap:// uri) and records result in scoreboard.
+  It returns true if server has answered within timeout_ms.
+*/
+    LDAP *ld = NULL;
+    if (ldap_initialize(&ld, uri.c_str()) != LDAP_SUCCESS) {
+        return false;
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int version = LDAP_VERSION3;
+    ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version);
+    ldap_set_option(ld, LDAP_OPT_NETWORK_TIMEOUT, &timeout);
+    ldap_set_option(ld, LDAP_OPT_TIMEOUT, &timeout);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+    char *attrs[] = {"1.1", NULL};
+#pragma GCC diagnostic pop
+    LDAPMessage *res = NULL;
+
+    double started = now_ms();
+    int result = ldap_search_ext_s(ld, "", LDAP_SCOPE_BASE, "(objectclass=*)", attrs, 1, NULL, NULL, &timeout, 1, &res);
+    double rtt = now_ms() - started;
+
+    ldap_msgfree(res);
+    ldap_unbind_ext(ld, NULL, NULL);
+
+    if (result == LDAP_SUCCESS) {
+        dcScoreboard::instance().success(uri, rtt);
+        return true;
+    }
+    if (dcScoreboard::serverFailure(result)) {
+        dcScoreboard::instance().failure(uri);
+    }
+    return false;
+}
+
+void client::probe(const vector <string> &uries, int timeout_ms) {
+/*
+  It probes all uries concurrently, see probe(uri, timeout_ms).
+*/
+    vector <std::future<bool> > probes;
+    for (size_t i = 0; i < uries.size(); ++i) {
+        probes.push_back(std::async(std::launch::async, [uri = uries[i], timeout_ms] {
+            return probe(uri, timeout_ms);
+        }));
+    }
+    for (size_t i = 0; i < probes.size(); ++i) {
+        probes[i].wait();
+    }
+}
+
+void client::observe(double started_ms, int result) {
+/*
+  It records result and round trip time of cheap operation, started at started_ms, in scoreboard.
+*/
+    if (dcScoreboard::serverFailure(result)) {
+        dcScoreboard::instance().failure(params.uri);
+    } else {
+        dcScoreboard::instance().success(params.uri, now_ms() - started_ms);
+    }
+}
+
+void client::observe(int result) {
+/*
+  It records result of operation, that takes as long as its size (pages, writes, sync cycles), in scoreboard.
+*/
+    if (dcScoreboard::serverFailure(result)) {
+        dcScoreboard::instance().failure(params.uri);
+    } else {
+        dcScoreboard::instance().success(params.uri, -1);
+    }
+}
@@ -0,0 +1,272 @@
+#include <memory>
+#include <thread>
+
+#include "client.h"
+
+/*
+  DNS SRV discovery of domain controllers.
+
+  Lookups go through a process-wide cache keyed by record name, entries live
+  for the smallest TTL of their records (SRV_NEGATIVE_TTL for failed lookups).
+  Concurrent lookups of the same name share a single DNS query.
+  Servers are ordered per RFC 2782: by priority, then weighted random within a priority.
+*/
+
+struct srvCacheEntry {
+    std::shared_future<vector<srvRecord> > records;
+    // 0 while the query is in flight
+    time_t expires;
+
+    srvCacheEntry() : expires(0) {}
+};
+
+static std::mutex srv_cache_mutex;
+static map <string, std::shared_ptr<srvCacheEntry> > srv_cache;
+
+vector<string> client::get_ldap_servers(string domain, string site) {
+/*
+  It returns LDAP servers of domain, servers of site (if given) go first.
+  Site and domain records are resolved concurrently.
+*/
+    string srv_default = "_ldap._tcp." + domain;
+
+    std::future<vector<srvRecord> > site_query;
+    if (!site.empty()) {
+        site_query = std::async(std::launch::async, lookup_srv, "_ldap._tcp." + site + "._sites." + domain);
+    }
+
+    vector<srvRecord> records_default;
+    std::exception_ptr default_error;
+    try {
+        records_default = lookup_srv(srv_default);
+    } catch (BindException &ex) {
+        default_error = std::current_exception();
+    }
+
+    vector<string> servers;
+    if (site_query.valid()) {
+        try {
+            servers = order_srv(site_query.get());
+        } catch (BindException &ex) { }
+
+        for (size_t i = 0; i < servers.size(); ++i) {
+            dcScoreboard::instance().setSite(servers[i], site);
+        }
+    }
+
+    if (default_error) {
+        std::rethrow_exception(default_error);
+    }
+    vector<string> servers_default = order_srv(records_default);
+
+    // extend site DCs list with all DCs list (except already added site DCs) in case when site DCs is unavailable
+    for (vector <string>::iterator it = servers_default.begin(); it != servers_default.end(); ++it) {
+        if (find(servers.begin(), servers.end(), *it) == servers.end()) {
+            servers.push_back(*it);
+        }
+    }
+
+    return servers;
+}
+
+void client::flush_srv_cache() {
+/*
+  It forgets all cached SRV lookups.
+*/
+    std::lock_guard<std::mutex> lock(srv_cache_mutex);
+    srv_cache.clear();
+}
+
+vector<srvRecord> client::lookup_srv(string srv_rec) {
+/*
+  It returns SRV records of srv_rec from cache, or queries DNS if they are missing or expired.
+  It throws BindException if lookup has failed, failures are cached too.
+*/
+    std::unique_lock<std::mutex> lock(srv_cache_mutex);
+
+    map <string, std::shared_ptr<srvCacheEntry> >::iterator it = srv_cache.find(srv_rec);
+    if (it != srv_cache.end() && (it->second->expires == 0 || it->second->expires > time(NULL))) {
+        std::shared_future<vector<srvRecord> > records = it->second->records;
+        lock.unlock();
+        return records.get();
+    }
+
+    std::shared_ptr<srvCacheEntry> entry = std::make_shared<srvCacheEntry>();
+    std::promise<vector<srvRecord> > promise;
+    entry->records = promise.get_future().share();
+    srv_cache[srv_rec] = entry;
+    lock.unlock();
+
+    vector<srvRecord> records;
+    try {
+        records = perform_srv_query(srv_rec);
+    } catch (...) {
+        lock.lock();
+        entry->expires = time(NULL) + SRV_NEGATIVE_TTL;
+        lock.unlock();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    int ttl = records.empty() ? SRV_NEGATIVE_TTL : INT_MAX;
+    for (size_t i = 0; i < records.size(); ++i) {
+        ttl = std::min(ttl, records[i].ttl);
+    }
+
+    lock.lock();
+    // record with zero TTL must not be cached, it expires right away
+    entry->expires = time(NULL) + ttl;
+    lock.unlock();
+    promise.set_value(records);
+
+    return records;
+}
+
+vector<string> client::order_srv(vector<srvRecord> records) {
+/*
+  It returns hosts ordered per RFC 2782: lower priority first, within the same priority
+  host is picked at random with probability proportional to its weight.
+*/
+    // <random> is not used, as <cmath> log() clashes with the global logger
+    static thread_local unsigned int seed = time(NULL) ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    // zero weight records go first within a priority, so they are picked only if nothing else is left
+    std::stable_sort(records.begin(), records.end(), [](const srvRecord &a, const srvRecord &b) {
+        if (a.priority != b.priority) return a.priority < b.priority;
+        return a.weight == 0 && b.weight != 0;
+    });
+
+    vector<string> hosts;
+    size_t group = 0;
+    while (group < records.size()) {
+        size_t group_end = group;
+        while (group_end < records.size() && records[group_end].priority == records[group].priority) {
+            ++group_end;
+        }
+
+        for (size_t next = group; next < group_end; ++next) {
+            long sum = 0;
+            for (size_t i = next; i < group_end; ++i) {
+                sum += records[i].weight;
+            }
+
+            long pick = (long) (rand_r(&seed) / ((double) RAND_MAX + 1) * (sum + 1));
+            size_t chosen = next;
+            for (long running = 0; chosen < group_end; ++chosen) {
+                running += records[chosen].weight;
+                if (running >= pick) break;
+            }
+            chosen = std::min(chosen, group_end - 1);
+            // move chosen record to the front of remaining ones, keeping their order
+            std::rotate(records.begin() + next, records.begin() + chosen, records.begin() + chosen + 1);
+            hosts.push_back(records[next].host);
+        }
+        group = group_end;
+    }
+
+    return hosts;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+// this magic was copy pasted and adopted from
+// https://www.ccnx.org/releases/latest/doc/ccode/html/ccndc-srv_8c_source.html
+vector<srvRecord> client::perform_srv_query(string srv_rec) {
+    union dns_ans {
+             HEADER header;
+             unsigned char buf[NS_MAXMSG];
+          } ans;
+    int ans_size;
+
+    char *srv_name = strdup(srv_rec.c_str());
+    if (!srv_name) {
+        throw BindException("Failed to allocate memory for srv_rec", LDAP_RESOLV_ERROR);
+    }
+
+    // thread-safe resolver state, lookups could run concurrently
+    struct __res_state res_state;
+    memset(&res_state, 0, sizeof(res_state));
+    if (res_ninit(&res_state) != 0) {
+        free(srv_name);
+        throw BindException("Error while resolving ldap server for " + srv_rec + ": res_ninit failed", LDAP_RESOLV_ERROR);
+    }
+    ans_size = res_nsearch(&res_state, srv_name, ns_c_in, ns_t_srv, ans.buf, sizeof(ans.buf));
+    res_nclose(&res_state);
+
+    if (ans_size < 0) {
+        free(srv_name);
+        throw BindException("Error while resolving ldap server for " + srv_rec + ": res_nsearch failed", LDAP_RESOLV_ERROR);
+    }
+
+    int qdcount, ancount;
+    qdcount = ntohs(ans.header.qdcount);
+    ancount = ntohs(ans.header.ancount);
+
+    unsigned char *msg, *msgend;
+    msg = ans.buf + sizeof(ans.header);
+    msgend = ans.buf + ans_size;
+
+    int size = 0, i;
+    for (i = qdcount; i > 0; --i) {
+        if ((size = dn_skipname(msg, msgend)) < 0) {
+            free(srv_name);
+            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_skipname < 0", LDAP_RESOLV_ERROR);
+        }
+        msg = msg + size + QFIXEDSZ;
+    }
+
+    int type = 0, priority = 0, weight = 0, port = 0, recclass = 0, ttl = 0;
+    unsigned char *end;
+    char host[NS_MAXDNAME];
+
+    vector<srvRecord> ret;
+    for (i = ancount; i > 0; --i) {
+        size = dn_expand(ans.buf, msgend, msg, srv_name, strlen(srv_name)+1);
+        if (size < 0) {
+            free(srv_name);
+            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_expand(srv_name) < 0", LDAP_RESOLV_ERROR);
+        }
+        msg = msg + size;
+
+        GETSHORT(type, msg);
+        GETSHORT(recclass, msg);
+        GETLONG(ttl, msg);
+        GETSHORT(size, msg);
+        if ((end = msg + size) > msgend) {
+            free(srv_name);
+            throw BindException("Error while resolving ldap server for " + srv_rec + ": (msg + size) > msgend", LDAP_RESOLV_ERROR);
+        }
+
+        if (type != ns_t_srv) {
+            msg = end;
+            continue;
+        }
+
+        GETSHORT(priority, msg);
+        GETSHORT(weight, msg);
+        GETSHORT(port, msg);
+        size = dn_expand(ans.buf, msgend, msg, host, sizeof(host));
+        if (size < 0) {
+            free(srv_name);
+            throw BindException("Error while resolving ldap server for " + srv_rec + ": dn_expand(host) < 0", LDAP_RESOLV_ERROR);
+        }
+        msg = end;
+
+        // "." target means the service is decidedly not available at this domain
+        if (host[0] == '\0' || string(host) == ".") {
+            continue;
+        }
+
+        srvRecord record;
+        record.host = host;
+        record.port = port;
+        record.priority = priority;
+        record.weight = weight;
+        record.ttl = std::max(ttl, 0);
+        ret.push_back(record);
+    }
+    free(srv_name);
+    return ret;
+}
+#pragma GCC diagnostic pop
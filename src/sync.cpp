@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+
+#include "client.h"
+
+/*
+  Incremental directory synchronization.
+
+  DirSync (Active Directory) and syncrepl refreshOnly (RFC 4533, OpenLDAP) return
+  changes since the state, that server has described by the cookie. uSNChanged is
+  the fallback for servers without these controls: cookie is the highest committed
+  USN of the domain controller, deletions are found as tombstones with show deleted
+  control. USNs are local to a domain controller, so a cycle against another one
+  returns full content.
+  Controls are encoded here, as older libldap has no DirSync and sync helpers.
+
+  Cookie file holds SYNC_COOKIE_HEADER, mode and newline, followed by the cookie.
+*/
+
+#define SYNC_COOKIE_HEADER "ldapcpp-sync "
+
+static LDAPControl *dirsync_control(int flags, int max_bytes, const string &cookie) {
+/*
+  It returns DirSync request control { flags, maxBytes, cookie }, caller frees it.
+*/
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    if (ber == NULL) throw SearchException("Failed to allocate DirSync control", LDAP_NO_MEMORY);
+
+    struct berval value;
+    if (ber_printf(ber, "{iio}", (ber_int_t) flags, (ber_int_t) max_bytes, cookie.data(), (ber_len_t) cookie.size()) == -1 ||
+        ber_flatten2(ber, &value, 1) == -1) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to encode DirSync control", LDAP_ENCODING_ERROR);
+    }
+    ber_free(ber, 1);
+
+    LDAPControl *control = NULL;
+    int result = ldap_control_create(LDAP_CONTROL_X_DIRSYNC, 1, &value, 0, &control);
+    if (result != LDAP_SUCCESS) {
+        ber_memfree(value.bv_val);
+        throw SearchException(string("Failed to create DirSync control: ") + ldap_err2string(result), result);
+    }
+    return control;
+}
+
+static bool parse_dirsync_control(LDAPControl *control, string &cookie) {
+/*
+  It reads cookie of DirSync response control { moreResults, unused, cookie }.
+  It returns true if server has more changes.
+*/
+    BerElement *ber = ber_init(&control->ldctl_value);
+    if (ber == NULL) throw SearchException("Failed to decode DirSync response control", LDAP_DECODING_ERROR);
+
+    ber_int_t more, unused;
+    struct berval value;
+    if (ber_scanf(ber, "{iim}", &more, &unused, &value) == LBER_ERROR) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to decode DirSync response control", LDAP_DECODING_ERROR);
+    }
+    cookie.assign(value.bv_val, value.bv_len);
+    ber_free(ber, 1);
+
+    return more != 0;
+}
+
+static LDAPControl *sync_request_control(const string &cookie) {
+/*
+  It returns syncrepl request control { refreshOnly, cookie }, caller frees it.
+*/
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    if (ber == NULL) throw SearchException("Failed to allocate sync request control", LDAP_NO_MEMORY);
+
+    int rc = ber_printf(ber, "{e", (ber_int_t) LDAP_SYNC_REFRESH_ONLY);
+    if (rc != -1 && !cookie.empty()) {
+        rc = ber_printf(ber, "o", cookie.data(), (ber_len_t) cookie.size());
+    }
+    if (rc != -1) {
+        rc = ber_printf(ber, "N}");
+    }
+
+    struct berval value;
+    if (rc == -1 || ber_flatten2(ber, &value, 1) == -1) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to encode sync request control", LDAP_ENCODING_ERROR);
+    }
+    ber_free(ber, 1);
+
+    LDAPControl *control = NULL;
+    int result = ldap_control_create(LDAP_CONTROL_SYNC, 1, &value, 0, &control);
+    if (result != LDAP_SUCCESS) {
+        ber_memfree(value.bv_val);
+        throw SearchException(string("Failed to create sync request control: ") + ldap_err2string(result), result);
+    }
+    return control;
+}
+
+static void parse_sync_state(LDAPControl *control, ber_int_t &state, string &uuid, string &cookie) {
+/*
+  It reads sync state control of an entry { state, entryUUID, cookie OPTIONAL },
+  cookie is updated only if it is present.
+*/
+    BerElement *ber = ber_init(&control->ldctl_value);
+    if (ber == NULL) throw SearchException("Failed to decode sync state control", LDAP_DECODING_ERROR);
+
+    struct berval value;
+    ber_len_t len;
+    if (ber_scanf(ber, "{em", &state, &value) == LBER_ERROR) {
+        ber_free(ber, 1);
+        throw SearchException("Failed to decode sync state control", LDAP_DECODING_ERROR);
+    }
+    uuid.assign(value.bv_val, value.bv_len);
+
+    if (ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE && ber_scanf(ber, "m", &value) != LBER_ERROR) {
+        cookie.assign(value.bv_val, value.bv_len);
+    }
+    ber_free(ber, 1);
+}
+
+static void parse_sync_info(struct berval *data, syncChanges &changes, string &cookie) {
+/*
+  It reads syncInfo intermediate message: a new cookie, end of refresh phase,
+  or a set of entryUUIDs of deleted (or present) entries.
+*/
+    BerElement *ber = ber_init(data);
+    if (ber == NULL) throw SearchException("Failed to decode syncInfo message", LDAP_DECODING_ERROR);
+
+    struct berval value;
+    ber_len_t len;
+    ber_tag_t tag = ber_peek_tag(ber, &len);
+    bool failed = false;
+
+    switch (tag) {
+    case LDAP_TAG_SYNC_NEW_COOKIE:
+        if (ber_scanf(ber, "m", &value) == LBER_ERROR) {
+            failed = true;
+            break;
+        }
+        cookie.assign(value.bv_val, value.bv_len);
+        break;
+    case LDAP_TAG_SYNC_REFRESH_DELETE:
+    case LDAP_TAG_SYNC_REFRESH_PRESENT:
+        // { cookie OPTIONAL, refreshDone DEFAULT TRUE }, refreshOnly search ends anyway
+        ber_skip_tag(ber, &len);
+        if (ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE) {
+            if (ber_scanf(ber, "m", &value) == LBER_ERROR) {
+                failed = true;
+                break;
+            }
+            cookie.assign(value.bv_val, value.bv_len);
+        }
+        break;
+    case LDAP_TAG_SYNC_ID_SET: {
+        // { cookie OPTIONAL, refreshDeletes DEFAULT FALSE, syncUUIDs }
+        ber_int_t refresh_deletes = 0;
+        BerVarray uuids = NULL;
+
+        ber_skip_tag(ber, &len);
+        if (ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE) {
+            if (ber_scanf(ber, "m", &value) == LBER_ERROR) {
+                failed = true;
+                break;
+            }
+            cookie.assign(value.bv_val, value.bv_len);
+        }
+        if (ber_peek_tag(ber, &len) == LDAP_TAG_REFRESHDELETES && ber_scanf(ber, "b", &refresh_deletes) == LBER_ERROR) {
+            failed = true;
+            break;
+        }
+        if (ber_scanf(ber, "[W]", &uuids) == LBER_ERROR) {
+            failed = true;
+            break;
+        }
+        vector <string> &ids = refresh_deletes ? changes.deleted_ids : changes.present_ids;
+        for (size_t i = 0; uuids != NULL && uuids[i].bv_val != NULL; ++i) {
+            ids.push_back(string(uuids[i].bv_val, uuids[i].bv_len));
+        }
+        ber_bvarray_free(uuids);
+        break;
+    }
+    default:
+        failed = true;
+    }
+    ber_free(ber, 1);
+
+    if (failed) throw SearchException("Failed to decode syncInfo message", LDAP_DECODING_ERROR);
+}
+
+static bool parse_sync_done(LDAPControl *control, string &cookie) {
+/*
+  It reads sync done control { cookie OPTIONAL, refreshDeletes DEFAULT FALSE }.
+  It returns refreshDeletes: false means the present phase was used.
+*/
+    BerElement *ber = ber_init(&control->ldctl_value);
+    if (ber == NULL) throw SearchException("Failed to decode sync done control", LDAP_DECODING_ERROR);
+
+    struct berval value;
+    ber_len_t len;
+    ber_int_t refresh_deletes = 0;
+    bool failed = (ber_skip_tag(ber, &len) == LBER_ERROR);
+
+    if (!failed && ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE) {
+        failed = (ber_scanf(ber, "m", &value) == LBER_ERROR);
+        if (!failed) cookie.assign(value.bv_val, value.bv_len);
+    }
+    if (!failed && ber_peek_tag(ber, &len) == LDAP_TAG_REFRESHDELETES) {
+        failed = (ber_scanf(ber, "b", &refresh_deletes) == LBER_ERROR);
+    }
+    ber_free(ber, 1);
+
+    if (failed) throw SearchException("Failed to decode sync done control", LDAP_DECODING_ERROR);
+    return refresh_deletes != 0;
+}
+
+static string first_value(LDAP *ds, LDAPMessage *entry, const char *attribute) {
+/*
+  It returns the first value of entry attribute, or empty string if there is none.
+*/
+    struct berval **values = ldap_get_values_len(ds, entry, attribute);
+    if (values == NULL) return "";
+
+    string value;
+    if (values[0] != NULL) {
+        value.assign(values[0]->bv_val, values[0]->bv_len);
+    }
+    ldap_value_free_len(values);
+    return value;
+}
+
+directorySync::directorySync(const syncParams &_params) {
+    params = _params;
+    current_mode = params.mode;
+    pending = false;
+
+    load();
+}
+
+syncChanges *directorySync::cycle(client &c) {
+/*
+  It returns changes since the last committed cycle. Their cookie becomes current on commit().
+  Whole cycle starts over in a new session, if the session was lost.
+*/
+    if (c.ds == NULL) throw SearchException("Failed to use LDAP connection handler", LDAP_CONNECTION_ERROR);
+
+    if (current_mode == SYNC_AUTO) {
+        current_mode = detect(c);
+    }
+
+    std::unique_ptr <syncChanges> changes;
+    for (int attempt = 0; ; ++attempt) {
+        string uri = c.binded_uri();
+
+        changes.reset(new syncChanges());
+        changes->changed = searchResultSet(c.names);
+        try {
+            switch (current_mode) {
+            case SYNC_DIRSYNC:
+                dirsync(c, *changes);
+                break;
+            case SYNC_SYNCREPL:
+                syncrepl(c, *changes);
+                c._resolveranges(changes->changed, 0);
+                break;
+            case SYNC_USNCHANGED:
+                usnchanged(c, *changes);
+                break;
+            default:
+                throw SearchException("Unknown sync mode " + itos(current_mode), PARAMS_ERROR);
+            }
+        } catch (SearchException &ex) {
+            if (c.retryRead(ex.code, attempt)) continue;
+            throw;
+        }
+
+        // highest committed USN belongs to the server, that has been asked first
+        if (current_mode == SYNC_USNCHANGED && c.binded_uri() != uri && attempt < c.params.read_retries) continue;
+        break;
+    }
+    pending = true;
+
+    // objects could be changed by other clients, their cached lookups are stale now.
+    // Renamed objects are cached under their old DNs, deleted AD objects are reported under
+    // tombstone DNs, so both are found by objectGUID.
+    for (size_t i = 0; i < changes->changed.size(); ++i) {
+        c.invalidateChanged(string(changes->changed.dn(i)), i < changes->changed_ids.size() ? changes->changed_ids[i] : "");
+    }
+    for (size_t i = 0; i < changes->deleted_ids.size(); ++i) {
+        c.invalidateChanged("", changes->deleted_ids[i]);
+    }
+    if (current_mode == SYNC_SYNCREPL) {
+        for (size_t i = 0; i < changes->deleted.size(); ++i) {
+            c.invalidate(changes->deleted[i], true);
+        }
+    }
+
+    return changes.release();
+}
+
+void directorySync::commit() {
+/*
+  It makes cookie of the last cycle current and saves it, changes of that cycle are not returned again.
+*/
+    if (!pending) return;
+
+    cookie = pending_cookie;
+    pending_cookie.clear();
+    pending = false;
+    save();
+}
+
+void directorySync::reset() {
+/*
+  It forgets cookie (and cookie of uncommitted cycle), the next cycle returns full content.
+*/
+    cookie.clear();
+    pending_cookie.clear();
+    pending = false;
+    save();
+}
+
+void directorySync::load() {
+/*
+  It reads cookie from cookie file. Cookie of another mode is ignored, as it describes another kind of state.
+*/
+    if (params.cookie_file.empty()) return;
+
+    std::ifstream file(params.cookie_file.c_str(), std::ios::in | std::ios::binary);
+    if (!file) return;
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+    string data = ss.str();
+
+    string header = SYNC_COOKIE_HEADER;
+    size_t eol = data.find('\n');
+    if (data.compare(0, header.size(), header) != 0 || eol == string::npos) {
+        log->error("Sync cookie file " + params.cookie_file + " is corrupted, it is ignored");
+        return;
+    }
+
+    int mode = atoi(data.substr(header.size(), eol - header.size()).c_str());
+    if (params.mode != SYNC_AUTO && params.mode != mode) {
+        log->debug("Sync cookie file " + params.cookie_file + " belongs to another mode, it is ignored");
+        return;
+    }
+    current_mode = mode;
+    cookie = data.substr(eol + 1);
+}
+
+void directorySync::save() {
+/*
+  It replaces cookie file atomically (write to a temporary file, then rename), so cookie is never lost half-written.
+*/
+    if (params.cookie_file.empty()) return;
+
+    string tmp = params.cookie_file + ".tmp";
+    string data = SYNC_COOKIE_HEADER + itos(current_mode) + "\n" + cookie;
+
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == NULL) {
+        throw OperationalException("Failed to save sync cookie to " + tmp + ": " + strerror(errno), LDAP_OTHER);
+    }
+    bool written = (fwrite(data.data(), 1, data.size(), file) == data.size()) && (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+    int error = errno;
+    if (fclose(file) != 0 && written) {
+        written = false;
+        error = errno;
+    }
+    if (!written || rename(tmp.c_str(), params.cookie_file.c_str()) != 0) {
+        if (written) error = errno;
+        unlink(tmp.c_str());
+        throw OperationalException("Failed to save sync cookie to " + params.cookie_file + ": " + strerror(error), LDAP_OTHER);
+    }
+}
+
+int directorySync::detect(client &c) {
+/*
+  It returns the mode, that server supports: DirSync, then syncrepl, uSNChanged otherwise.
+  DirSync needs "Replicating Directory Changes" right, use SYNC_USNCHANGED for accounts without it.
+*/
+    vector <string> attributes;
+    attributes.push_back("supportedControl");
+
+    map <string, vector <string> > rootdse = c.rootDSE(attributes);
+    vector <string> &controls = rootdse["supportedControl"];
+
+    if (find(controls.begin(), controls.end(), LDAP_CONTROL_X_DIRSYNC) != controls.end()) {
+        return SYNC_DIRSYNC;
+    }
+    if (find(controls.begin(), controls.end(), LDAP_CONTROL_SYNC) != controls.end()) {
+        return SYNC_SYNCREPL;
+    }
+    return SYNC_USNCHANGED;
+}
+
+void directorySync::dirsync(client &c, syncChanges &changes) {
+/*
+  It asks changes with DirSync control until server has no more of them.
+  Deleted objects are returned as tombstones (isDeleted is TRUE), with tombstone DN.
+*/
+    attributeList attrs(params.attributes);
+    string next = cookie;
+    changes.full = cookie.empty();
+
+    for (bool more = true; more; ) {
+        LDAPControl *serverctrls[2] = { dirsync_control(params.dirsync_flags, params.dirsync_max_bytes, next), NULL };
+        LDAPMessage *res = NULL;
+
+        int result = ldap_search_ext_s(c.ds, params.search_base.c_str(), LDAP_SCOPE_SUBTREE, params.filter.c_str(), attrs.get(), 0, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &res);
+        c.observe(result);
+        ldap_control_free(serverctrls[0]);
+
+        if (result != LDAP_SUCCESS) {
+            ldap_msgfree(res);
+            throw SearchException(string("Error in DirSync ldap_search_ext_s: ") + ldap_err2string(result), result);
+        }
+
+        LDAPControl **returnedctrls = NULL;
+        try {
+            for (LDAPMessage *entry = ldap_first_entry(c.ds, res); entry != NULL; entry = ldap_next_entry(c.ds, entry)) {
+                string guid = first_value(c.ds, entry, "objectGUID");
+                if (upper(first_value(c.ds, entry, "isDeleted")) == "TRUE") {
+                    char *dn = ldap_get_dn(c.ds, entry);
+                    changes.deleted.push_back(dn != NULL ? dn : "");
+                    ldap_memfree(dn);
+                    changes.deleted_ids.push_back(guid);
+                    continue;
+                }
+                // DirSync names incremental values of linked attributes "member;range=1-1", they are not ranges
+                c._appendentry(entry, changes.changed);
+                changes.changed_ids.push_back(guid);
+            }
+
+            int errcodep;
+            result = ldap_parse_result(c.ds, res, &errcodep, NULL, NULL, NULL, &returnedctrls, 0);
+            if (result != LDAP_SUCCESS) {
+                throw SearchException(string("Failed to parse DirSync result: ") + ldap_err2string(result), result);
+            }
+            LDAPControl *control = ldap_control_find(LDAP_CONTROL_X_DIRSYNC, returnedctrls, NULL);
+            if (control == NULL) {
+                throw SearchException("Failed to find DirSync response control", 255);
+            }
+            more = parse_dirsync_control(control, next);
+        } catch (...) {
+            ldap_controls_free(returnedctrls);
+            ldap_msgfree(res);
+            throw;
+        }
+        ldap_controls_free(returnedctrls);
+        ldap_msgfree(res);
+    }
+
+    pending_cookie = next;
+}
+
+void directorySync::syncrepl(client &c, syncChanges &changes) {
+/*
+  It runs refreshOnly content synchronization. Server answers with changed entries and
+  either deleted entries (refreshDeletes) or all present ones (present phase), see syncChanges.
+  If server has dropped the history of the cookie, refresh starts over without it.
+*/
+    attributeList attrs(params.attributes);
+    string next = cookie;
+
+    for (;;) {
+        changes.full = next.empty();
+
+        LDAPControl *serverctrls[2] = { sync_request_control(next), NULL };
+        int msgid;
+        int result = ldap_search_ext(c.ds, params.search_base.c_str(), LDAP_SCOPE_SUBTREE, params.filter.c_str(), attrs.get(), 0, serverctrls, NULL, NULL, LDAP_NO_LIMIT, &msgid);
+        ldap_control_free(serverctrls[0]);
+        if (result != LDAP_SUCCESS) {
+            c.observe(result);
+            throw SearchException(string("Error in syncrepl ldap_search_ext: ") + ldap_err2string(result), result);
+        }
+
+        // a stalled server fails the cycle, so its cookie is not committed
+        struct timeval timeout;
+        timeout.tv_sec = c.params.nettimeout > 0 ? c.params.nettimeout : SYNC_RESULT_TIMEOUT;
+        timeout.tv_usec = 0;
+
+        bool done = false;
+        bool refresh_required = false;
+        while (!done) {
+            LDAPMessage *res = NULL;
+            int rc = ldap_result(c.ds, msgid, LDAP_MSG_ONE, &timeout, &res);
+            if (rc == 0) {
+                ldap_abandon_ext(c.ds, msgid, NULL, NULL);
+                c.observe(LDAP_TIMEOUT);
+                ldap_msgfree(res);
+                throw SearchException("Error in syncrepl ldap_result: no response within " + itos(timeout.tv_sec) + "s", LDAP_TIMEOUT);
+            }
+            if (rc < 0) {
+                ldap_get_option(c.ds, LDAP_OPT_RESULT_CODE, &result);
+                c.observe(result);
+                ldap_msgfree(res);
+                throw SearchException(string("Error in syncrepl ldap_result: ") + ldap_err2string(result), result);
+            }
+
+            LDAPControl **ctrls = NULL;
+            char *oid = NULL;
+            struct berval *data = NULL;
+            try {
+                switch (ldap_msgtype(res)) {
+                case LDAP_RES_SEARCH_ENTRY: {
+                    LDAPControl *control = NULL;
+                    if (ldap_get_entry_controls(c.ds, res, &ctrls) == LDAP_SUCCESS) {
+                        control = ldap_control_find(LDAP_CONTROL_SYNC_STATE, ctrls, NULL);
+                    }
+                    if (control == NULL) {
+                        throw SearchException("Failed to find sync state control of entry", 255);
+                    }
+
+                    ber_int_t state;
+                    string uuid;
+                    parse_sync_state(control, state, uuid, next);
+                    if (state == LDAP_SYNC_PRESENT) {
+                        changes.present_ids.push_back(uuid);
+                    } else if (state == LDAP_SYNC_DELETE) {
+                        char *dn = ldap_get_dn(c.ds, res);
+                        changes.deleted.push_back(dn != NULL ? dn : "");
+                        ldap_memfree(dn);
+                        changes.deleted_ids.push_back(uuid);
+                    } else {
+                        c._appendentry(res, changes.changed);
+                        changes.changed_ids.push_back(uuid);
+                    }
+                    break;
+                }
+                case LDAP_RES_INTERMEDIATE:
+                    result = ldap_parse_intermediate(c.ds, res, &oid, &data, NULL, 0);
+                    if (result != LDAP_SUCCESS) {
+                        throw SearchException(string("Failed to parse syncrepl intermediate message: ") + ldap_err2string(result), result);
+                    }
+                    if (oid != NULL && data != NULL && strcmp(oid, LDAP_SYNC_INFO) == 0) {
+                        parse_sync_info(data, changes, next);
+                    }
+                    break;
+                case LDAP_RES_SEARCH_RESULT: {
+                    int errcodep;
+                    result = ldap_parse_result(c.ds, res, &errcodep, NULL, NULL, NULL, &ctrls, 0);
+                    if (result == LDAP_SUCCESS) result = errcodep;
+                    c.observe(result);
+                    done = true;
+
+                    if (result == LDAP_SYNC_REFRESH_REQUIRED && !next.empty()) {
+                        refresh_required = true;
+                        break;
+                    }
+                    if (result != LDAP_SUCCESS) {
+                        throw SearchException(string("Error in syncrepl search: ") + ldap_err2string(result), result);
+                    }
+                    LDAPControl *control = ldap_control_find(LDAP_CONTROL_SYNC_DONE, ctrls, NULL);
+                    bool refresh_deletes = (control != NULL) ? parse_sync_done(control, next) : false;
+                    changes.refresh_present = !changes.full && !refresh_deletes;
+                    break;
+                }
+                }
+            } catch (...) {
+                if (!done) ldap_abandon_ext(c.ds, msgid, NULL, NULL);
+                ldap_memfree(oid);
+                ber_bvfree(data);
+                ldap_controls_free(ctrls);
+                ldap_msgfree(res);
+                throw;
+            }
+            ldap_memfree(oid);
+            ber_bvfree(data);
+            ldap_controls_free(ctrls);
+            ldap_msgfree(res);
+        }
+
+        if (!refresh_required) break;
+
+        log->debug("Sync cookie is not valid anymore, full refresh is done");
+        next.clear();
+        changes = syncChanges();
+        changes.changed = searchResultSet(c.names);
+    }
+
+    pending_cookie = next;
+}
+
+void directorySync::usnchanged(client &c, syncChanges &changes) {
+/*
+  It searches entries with uSNChanged above the high-water mark of the cookie ("server\nusn"),
+  and tombstones (from the naming context of search base, so they could be outside of it).
+  Objects moved out of search base are not reported.
+*/
+    vector <string> attributes;
+    attributes.push_back("dsServiceName");
+    attributes.push_back("highestCommittedUSN");
+    map <string, vector <string> > rootdse = c.rootDSE(attributes);
+    if (rootdse["dsServiceName"].empty() || rootdse["highestCommittedUSN"].empty()) {
+        throw SearchException("Server does not publish highestCommittedUSN, uSNChanged sync is not possible", PARAMS_ERROR);
+    }
+    string server = rootdse["dsServiceName"][0];
+    string highest = rootdse["highestCommittedUSN"][0];
+
+    string last_usn;
+    size_t eol = cookie.rfind('\n');
+    if (eol != string::npos && cookie.compare(0, eol, server) == 0) {
+        last_usn = cookie.substr(eol + 1);
+    }
+    changes.full = last_usn.empty();
+    string usn_filter = changes.full ? "" : "(uSNChanged>=" + std::to_string(atoll(last_usn.c_str()) + 1) + ")";
+
+    // entries are identified by objectGUID, it is requested if not all attributes are
+    attributes = params.attributes;
+    bool all_attributes = attributes.empty();
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        if (attributes[i] == "*" || upper(attributes[i]) == "OBJECTGUID") all_attributes = true;
+    }
+    if (!all_attributes) attributes.push_back("objectGUID");
+
+    string filter = changes.full ? params.filter : "(&" + params.filter + usn_filter + ")";
+    clientSearchParams sparams;
+    try {
+        std::unique_ptr <searchResultSet> found(c.searchResults(params.search_base, filter, LDAP_SCOPE_SUBTREE, attributes, sparams));
+        changes.changed = std::move(*found);
+    } catch (SearchException &ex) {
+        if (ex.code != OBJECT_NOT_FOUND) throw;
+    }
+    for (size_t i = 0; i < changes.changed.size(); ++i) {
+        long attr = changes.changed.findAttribute(i, "objectGUID");
+        changes.changed_ids.push_back(attr < 0 ? "" : string(changes.changed.value(i, attr, 0)));
+    }
+
+    if (!changes.full) {
+        // naming context is the domain part of search base
+        string nc = params.search_base;
+        string nc_upper = upper(nc);
+        for (size_t dc = nc_upper.find("DC="); dc != string::npos; dc = nc_upper.find("DC=", dc + 1)) {
+            if (dc == 0 || nc_upper[dc - 1] == ',') {
+                nc = nc.substr(dc);
+                break;
+            }
+        }
+
+        vector <string> guid;
+        guid.push_back("objectGUID");
+        sparams.show_deleted = true;
+        try {
+            std::unique_ptr <searchResultSet> tombstones(c.searchResults(nc, "(&(isDeleted=TRUE)" + usn_filter + ")", LDAP_SCOPE_SUBTREE, guid, sparams));
+            for (size_t i = 0; i < tombstones->size(); ++i) {
+                long attr = tombstones->findAttribute(i, "objectGUID");
+                changes.deleted.push_back(string(tombstones->dn(i)));
+                changes.deleted_ids.push_back(attr < 0 ? "" : string(tombstones->value(i, attr, 0)));
+            }
+        } catch (SearchException &ex) {
+            if (ex.code != OBJECT_NOT_FOUND) throw;
+        }
+    }
+
+    // changes made during the search are above highest, so they are asked again the next time
+    pending_cookie = server + "\n" + highest;
+}
@@ -0,0 +1,166 @@
+package ldapcpp
+
+import (
+	"errors"
+	"sync"
+)
+
+// sync modes
+const (
+	// SyncAuto uses DirSync on Active Directory, syncrepl on OpenLDAP and SyncUSNChanged otherwise.
+	// The mode in use is kept with the cookie.
+	SyncAuto = 0
+	// SyncDirSync uses the DirSync control, BaseDN must be the root of a naming context
+	// and the account needs the "Replicating Directory Changes" right
+	SyncDirSync = 1
+	// SyncSyncRepl uses RFC 4533 content synchronization (refreshOnly)
+	SyncSyncRepl = 2
+	// SyncUSNChanged tracks uSNChanged of a single domain controller, it needs no special rights.
+	// A Sync against another domain controller returns the whole content.
+	SyncUSNChanged = 3
+)
+
+var errSyncerClosed = NewError(ErrorNetwork, errors.New("syncer is closed"))
+
+// SyncRequest describes the part of the directory, that is kept in a replica
+type SyncRequest struct {
+	BaseDN     string
+	Filter     string
+	Attributes []string
+	Mode       int
+	// CookieFile keeps the sync state between runs, the state is kept in memory only if empty
+	CookieFile string
+	// DirSyncFlags are DirSync control flags, e.g. 0x800 for parents before children
+	DirSyncFlags int
+}
+
+// SyncResult holds the changes since the previous Sync. Entries are identified by
+// objectGUID (Active Directory) or entryUUID (syncrepl), in their 16 bytes binary form.
+type SyncResult struct {
+	// Full is set when Changed is the whole content, the replica must be replaced with it
+	Full bool
+	// Changed are added and modified entries, ChangedIDs are their ids.
+	// DirSync returns changed attributes only.
+	Changed    []*Entry
+	ChangedIDs []string
+	// Deleted are DNs of deleted entries (tombstone DNs on Active Directory), DeletedIDs are their ids
+	Deleted    []string
+	DeletedIDs []string
+	// RefreshPresent is set when entries of the replica, that are neither in ChangedIDs
+	// nor in PresentIDs, have been deleted
+	RefreshPresent bool
+	PresentIDs     []string
+}
+
+// Syncer keeps a replica current with incremental changes of the directory.
+type Syncer struct {
+	sync.Mutex
+
+	conn  *Conn
+	state DirectorySync
+}
+
+// NewSyncer creates a syncer of the request. It resumes from the cookie file, if there is one.
+func (conn *Conn) NewSyncer(req *SyncRequest) *Syncer {
+	params := NewSyncParams()
+	defer DeleteSyncParams(params)
+
+	cAttrs := slice2vector(req.Attributes)
+	defer DeleteStringVector(cAttrs)
+
+	params.SetMode(req.Mode)
+	params.SetSearch_base(req.BaseDN)
+	if req.Filter != "" {
+		params.SetFilter(req.Filter)
+	}
+	params.SetAttributes(cAttrs)
+	params.SetCookie_file(req.CookieFile)
+	params.SetDirsync_flags(req.DirSyncFlags)
+
+	return &Syncer{
+		conn:  conn,
+		state: NewDirectorySync(params),
+	}
+}
+
+// Sync fetches the changes since the previous Sync and passes them to apply.
+// The cookie is saved only when apply has succeeded, otherwise the same changes
+// are fetched again by the next Sync.
+func (s *Syncer) Sync(apply func(result *SyncResult) error) error {
+	s.Lock()
+	defer s.Unlock()
+
+	if s.state == nil {
+		return errSyncerClosed
+	}
+
+	var result *SyncResult
+	var decodeErr error
+
+	err := s.conn.lease(func(client Client) {
+		changes := s.state.Cycle(client)
+		defer DeleteSyncChanges(changes)
+
+		result, decodeErr = newSyncResult(changes, s.conn.names)
+	})
+	if err == nil {
+		err = decodeErr
+	}
+	if err != nil {
+		return err
+	}
+
+	if err := apply(result); err != nil {
+		return err
+	}
+	return s.commit()
+}
+
+func (s *Syncer) commit() (err error) {
+	defer Recover(&err)
+
+	s.state.Commit()
+	return nil
+}
+
+// Reset forgets the sync state, the next Sync returns the whole content.
+func (s *Syncer) Reset() (err error) {
+	s.Lock()
+	defer s.Unlock()
+
+	if s.state == nil {
+		return errSyncerClosed
+	}
+	defer Recover(&err)
+
+	s.state.Reset()
+	return nil
+}
+
+// Close releases the syncer, the cookie file is kept.
+func (s *Syncer) Close() {
+	s.Lock()
+	defer s.Unlock()
+
+	if s.state != nil {
+		DeleteDirectorySync(s.state)
+		s.state = nil
+	}
+}
+
+func newSyncResult(changes SyncChanges, names *attributeNames) (*SyncResult, error) {
+	entries, err := newEntries(changes.GetChanged(), names)
+	if err != nil {
+		return nil, err
+	}
+
+	return &SyncResult{
+		Full:           changes.GetFull(),
+		Changed:        entries,
+		ChangedIDs:     vector2slice(changes.GetChanged_ids()),
+		Deleted:        vector2slice(changes.GetDeleted()),
+		DeletedIDs:     vector2slice(changes.GetDeleted_ids()),
+		RefreshPresent: changes.GetRefresh_present(),
+		PresentIDs:     vector2slice(changes.GetPresent_ids()),
+	}, nil
+}
@@ -2,6 +2,8 @@ package ldapcpp
 
 import "C"
 
+import "unsafe"
+
 func vector2slice(vector StringVector) []string {
 	result := make([]string, vector.Size())
 	for i := 0; i < int(vector.Size()); i++ {
@@ -9,3 +11,25 @@ func vector2slice(vector StringVector) []string {
 	}
 	return result
 }
+
+// slice2vector returns a new StringVector, that must be deleted by the caller
+func slice2vector(slice []string) StringVector {
+	vector := NewStringVector()
+	for _, value := range slice {
+		vector.Add(value)
+	}
+	return vector
+}
+
+// unsafeBytes returns the bytes of s without copying, they must not be modified
+func unsafeBytes(s string) []byte {
+	return *(*[]byte)(unsafe.Pointer(&struct {
+		string
+		int
+	}{s, len(s)}))
+}
+
+// unsafeString returns b as a string without copying, b must not be modified afterwards
+func unsafeString(b []byte) string {
+	return *(*string)(unsafe.Pointer(&b))
+}